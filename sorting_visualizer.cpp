@@ -2,102 +2,4473 @@
 #include <vector>
 #include <random>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <chrono>
 #include <thread>
 #include <sstream>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <type_traits>
+#include <memory>
+#include <cmath>
+#include <numbers>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <new>
+#include <array>
+#include <bit>
+#include <unordered_map>
+#include <map>
+#include <filesystem>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SORTING_NETWORK_X86 1
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+enum class StepType { Compare, Swap, Write, Read, Pivot, Run };
+
+// One visible operation performed by a sorting algorithm.
+struct SortStep {
+    StepType type;
+    size_t first;
+    size_t second;
+    unsigned worker = 0; // 1-based id of the pool thread that performed it, 0 if sequential
+    uint8_t cacheLevel[2] = {}; // Simulated level that served first/second (1 = L1), 0 if not simulated
+};
+
+// Per-thread free lists of coroutine frames in 64-byte size classes. Recursive algorithms
+// create a frame per call; recycling them means a sort stops allocating once its deepest
+// call chain has been seen.
+class FramePool {
+public:
+    static FramePool& local() {
+        thread_local FramePool pool;
+        return pool;
+    }
+
+    ~FramePool() {
+        for (Block*& list : freeLists) {
+            while (list) {
+                Block* next = list->next;
+                ::operator delete(list);
+                list = next;
+            }
+        }
+    }
+
+    void* allocate(size_t size) {
+        size_t sizeClass = (size + granularity - 1) / granularity;
+        if (sizeClass >= classCount) return ::operator new(size);
+        if (Block* block = freeLists[sizeClass]) {
+            freeLists[sizeClass] = block->next;
+            return block;
+        }
+        return ::operator new(sizeClass * granularity);
+    }
+
+    void release(void* pointer, size_t size) {
+        size_t sizeClass = (size + granularity - 1) / granularity;
+        if (sizeClass >= classCount) {
+            ::operator delete(pointer);
+            return;
+        }
+        Block* block = static_cast<Block*>(pointer);
+        block->next = freeLists[sizeClass];
+        freeLists[sizeClass] = block;
+    }
+
+private:
+    struct Block {
+        Block* next;
+    };
+    static constexpr size_t granularity = 64;
+    static constexpr size_t classCount = 32;
+    Block* freeLists[classCount] = {};
+};
+
+// Resumable sorting routine. An algorithm co_yields a SortStep after every compare/swap/write,
+// and can co_yield a nested SortTask (a recursive call or helper) which runs to completion
+// before the caller continues. Only the root task is driven from outside via next().
+class SortTask {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct promise_type {
+        SortStep current{};
+        promise_type* root = this;
+        bool suspendOnStep = true; // Only read on the root; false runs the whole algorithm in one next()
+        bool stepped = false; // Set on the root when a step suspended the task
+        Handle parent;
+        Handle leaf; // Innermost running task, only maintained on the root
+        std::exception_ptr error;
+
+        struct StepAwaiter {
+            bool suspend;
+            bool await_ready() noexcept { return !suspend; }
+            void await_suspend(std::coroutine_handle<>) noexcept {}
+            void await_resume() noexcept {}
+        };
+
+        // Entering and leaving a nested task returns to next(), which resumes the new leaf.
+        // Symmetric transfer would avoid that hop but is only a guaranteed tail call in
+        // optimized builds; without it, deep recursion would grow the native stack.
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(Handle h) noexcept {
+                promise_type& p = h.promise();
+                if (p.parent) p.root->leaf = p.parent;
+            }
+            void await_resume() noexcept {}
+        };
+
+        // Owns the child task's frame until the parent resumes past the co_yield.
+        struct NestedAwaiter {
+            Handle child;
+            explicit NestedAwaiter(Handle h) : child(h) {}
+            NestedAwaiter(NestedAwaiter&& other) noexcept : child(std::exchange(other.child, nullptr)) {}
+            ~NestedAwaiter() {
+                if (child) child.destroy();
+            }
+            bool await_ready() noexcept { return !child; }
+            void await_suspend(Handle h) noexcept {
+                promise_type& p = child.promise();
+                p.root = h.promise().root;
+                p.parent = h;
+                p.root->leaf = child;
+            }
+            void await_resume() {
+                if (child && child.promise().error) {
+                    std::rethrow_exception(child.promise().error);
+                }
+            }
+        };
+
+        static void* operator new(size_t size) { return FramePool::local().allocate(size); }
+        static void operator delete(void* pointer, size_t size) { FramePool::local().release(pointer, size); }
+
+        SortTask get_return_object() { return SortTask(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        StepAwaiter yield_value(const SortStep& step) {
+            root->current = step;
+            root->stepped = root->suspendOnStep;
+            return {root->suspendOnStep};
+        }
+        NestedAwaiter yield_value(SortTask&& task) { return NestedAwaiter(std::exchange(task.handle, nullptr)); }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    SortTask() = default;
+    SortTask(SortTask&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    SortTask& operator=(SortTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    SortTask(const SortTask&) = delete;
+    SortTask& operator=(const SortTask&) = delete;
+    ~SortTask() { reset(); }
+
+    // Runs until the next step is produced. Returns false once the algorithm has finished.
+    bool next() {
+        if (!handle || handle.done()) return false;
+        promise_type& root = handle.promise();
+        root.stepped = false;
+        do {
+            root.leaf.resume();
+            if (root.error) {
+                std::rethrow_exception(root.error);
+            }
+        } while (!root.stepped && !handle.done());
+        return !handle.done();
+    }
+
+    // Runs the algorithm to completion without suspending on steps, so each step costs only
+    // the counter update. Used by the headless benchmark.
+    void run() {
+        if (!handle || handle.done()) return;
+        handle.promise().suspendOnStep = false;
+        next();
+    }
+
+    const SortStep& step() const { return handle.promise().current; }
+    bool active() const { return handle && !handle.done(); }
+
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+private:
+    explicit SortTask(Handle h) : handle(h) { handle.promise().leaf = handle; }
+    Handle handle;
+};
+
+// Binary operation trace, written and read through mmap (POSIX only).
+//
+// Layout: TraceHeader, then a stream of records, then the keyframe index (one uint64 block
+// offset per keyframe). A step record is
+//   [type | worker << 3 byte][zigzag varint: first - previous first][zigzag varint: second - first]
+//   [zigzag varint: new - old value, writes only][total record length byte]
+// The trailing length byte lets the stream be decoded backwards. A keyframe block is
+//   [0xFF][step][comparisons][swaps][previous first][n x int32 snapshot][block size][0xFF]
+// and is emitted before the first record and then every keyframeInterval steps.
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyframeInterval;
+    uint64_t elementCount;
+    uint64_t stepCount;
+    uint64_t keyframeCount;
+    uint64_t indexOffset;
+    char algorithm[32];
+};
+
+const char traceMagic[8] = {'S', 'V', 'T', 'R', 'A', 'C', 'E', '1'};
+const unsigned char keyframeMarker = 0xFF;
+
+inline uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+inline int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+class TraceWriter {
+private:
+    int fd = -1;
+    unsigned char* base = nullptr;
+    size_t capacity = 0;
+    size_t size = 0;
+    uint64_t stepCount = 0;
+    uint64_t keyframeInterval = 0;
+    size_t previousFirst = 0;
+    std::vector<uint64_t> keyframeOffsets;
+
+    // Grows the file and the mapping so that `bytes` more can be written.
+    bool reserve(size_t bytes) {
+        if (size + bytes <= capacity) return true;
+#ifndef _WIN32
+        size_t newCapacity = std::max(capacity * 2, size + bytes + (64u << 20));
+        if (base) munmap(base, capacity);
+        base = nullptr;
+        if (ftruncate(fd, newCapacity) != 0) return false;
+        void* mapped = mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+        base = static_cast<unsigned char*>(mapped);
+        capacity = newCapacity;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void put(const void* data, size_t bytes) {
+        if (bytes == 0) return; // data may be null, e.g. an empty array's
+        std::memcpy(base + size, data, bytes);
+        size += bytes;
+    }
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            base[size++] = static_cast<unsigned char>(value | 0x80);
+            value >>= 7;
+        }
+        base[size++] = static_cast<unsigned char>(value);
+    }
+
+public:
+    ~TraceWriter() { close(); }
+
+    bool isOpen() const { return base != nullptr; }
+
+    // Creates the file and writes the header and the initial keyframe.
+    bool open(const std::string& path, const std::string& algorithm, const std::vector<int>& arr, uint64_t interval) {
+#ifndef _WIN32
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        keyframeInterval = std::max<uint64_t>(interval, 1);
+        stepCount = 0;
+        previousFirst = 0;
+        keyframeOffsets.clear();
+        size = sizeof(TraceHeader);
+        if (!reserve(0)) return false;
+        TraceHeader header{};
+        std::memcpy(header.magic, traceMagic, sizeof(traceMagic));
+        header.version = 1;
+        header.keyframeInterval = static_cast<uint32_t>(keyframeInterval);
+        header.elementCount = arr.size();
+        std::strncpy(header.algorithm, algorithm.c_str(), sizeof(header.algorithm) - 1);
+        std::memcpy(base, &header, sizeof(header));
+        return writeKeyframe(arr, 0, 0);
+#else
+        (void)path; (void)algorithm; (void)arr; (void)interval;
+        return false;
+#endif
+    }
+
+    // Appends one step. `delta` is new - old value for writes. Returns true when a keyframe is due.
+    bool record(const SortStep& step, int64_t delta) {
+        if (!reserve(32)) throw std::runtime_error("trace file could not be extended");
+        size_t start = size;
+        base[size++] = static_cast<unsigned char>(static_cast<unsigned>(step.type) | std::min(step.worker, 31u) << 3);
+        putVarint(zigzag(static_cast<int64_t>(step.first) - static_cast<int64_t>(previousFirst)));
+        putVarint(zigzag(static_cast<int64_t>(step.second) - static_cast<int64_t>(step.first)));
+        if (step.type == StepType::Write) {
+            putVarint(zigzag(delta));
+        }
+        base[size] = static_cast<unsigned char>(size - start + 1);
+        ++size;
+        previousFirst = step.first;
+        return ++stepCount % keyframeInterval == 0;
+    }
+
+    bool writeKeyframe(const std::vector<int>& arr, unsigned long long comparisons, unsigned long long swaps) {
+        size_t snapshotBytes = arr.size() * sizeof(int32_t);
+        uint64_t blockSize = 2 + 5 * sizeof(uint64_t) + snapshotBytes;
+        if (!reserve(blockSize)) throw std::runtime_error("trace file could not be extended");
+        keyframeOffsets.push_back(size);
+        uint64_t fields[4] = {stepCount, comparisons, swaps, previousFirst};
+        base[size++] = keyframeMarker;
+        put(fields, sizeof(fields));
+        put(arr.data(), snapshotBytes);
+        put(&blockSize, sizeof(blockSize));
+        base[size++] = keyframeMarker;
+        return true;
+    }
+
+    // Writes the keyframe index, fixes up the header and truncates the file to its final size.
+    void close() {
+#ifndef _WIN32
+        if (base && reserve(keyframeOffsets.size() * sizeof(uint64_t))) {
+            TraceHeader header;
+            std::memcpy(&header, base, sizeof(header));
+            header.stepCount = stepCount;
+            header.keyframeCount = keyframeOffsets.size();
+            header.indexOffset = size;
+            put(keyframeOffsets.data(), keyframeOffsets.size() * sizeof(uint64_t));
+            std::memcpy(base, &header, sizeof(header));
+        }
+        if (base) munmap(base, capacity);
+        if (fd >= 0) {
+            if (ftruncate(fd, size) != 0) {
+                std::cerr << "Failed to truncate trace file\n";
+            }
+            ::close(fd);
+        }
+#endif
+        base = nullptr;
+        fd = -1;
+        capacity = 0;
+    }
+
+    uint64_t steps() const { return stepCount; }
+    size_t bytesWritten() const { return size; }
+};
+
+// Maps a trace read-only and moves an array forwards or backwards through it.
+class TraceReader {
+private:
+    const unsigned char* base = nullptr;
+    size_t fileSize = 0;
+    TraceHeader header{};
+    size_t offset = 0;
+    uint64_t stepIndex = 0;
+    size_t previousFirst = 0;
+
+    uint64_t readVarint(size_t& pos) const {
+        uint64_t value = 0;
+        int shift = 0;
+        while (base[pos] & 0x80) {
+            value |= static_cast<uint64_t>(base[pos++] & 0x7F) << shift;
+            shift += 7;
+        }
+        value |= static_cast<uint64_t>(base[pos++]) << shift;
+        return value;
+    }
+
+    uint64_t readU64(size_t pos) const {
+        uint64_t value;
+        std::memcpy(&value, base + pos, sizeof(value));
+        return value;
+    }
+
+    size_t keyframeOffset(uint64_t index) const { return readU64(header.indexOffset + index * sizeof(uint64_t)); }
+    size_t keyframeSize() const { return 2 + 5 * sizeof(uint64_t) + header.elementCount * sizeof(int32_t); }
+
+    struct Record {
+        StepType type;
+        unsigned worker;
+        int64_t firstDelta;
+        int64_t secondDelta;
+        int64_t valueDelta;
+    };
+
+    // Decodes the record starting at `pos` and leaves `pos` just past its length byte.
+    Record decode(size_t& pos) const {
+        Record record{};
+        record.type = static_cast<StepType>(base[pos] & 7);
+        record.worker = base[pos++] >> 3;
+        record.firstDelta = unzigzag(readVarint(pos));
+        record.secondDelta = unzigzag(readVarint(pos));
+        if (record.type == StepType::Write) {
+            record.valueDelta = unzigzag(readVarint(pos));
+        }
+        ++pos;
+        return record;
+    }
+
+    void countStep(StepType type, int direction) {
+        if (type == StepType::Compare) comparisons += direction;
+        if (type == StepType::Swap || type == StepType::Write) swaps += direction;
+    }
+
+public:
+    unsigned long long comparisons = 0;
+    unsigned long long swaps = 0;
+
+    ~TraceReader() { close(); }
+
+    bool open(const std::string& path, std::string& error) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(TraceHeader)) {
+            ::close(fd);
+            error = "not a trace file";
+            return false;
+        }
+        fileSize = info.st_size;
+        void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = "mmap failed";
+            return false;
+        }
+        base = static_cast<const unsigned char*>(mapped);
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, traceMagic, sizeof(traceMagic)) != 0 || header.version != 1 ||
+            header.elementCount == 0 || header.keyframeCount == 0 || header.indexOffset + header.keyframeCount * sizeof(uint64_t) > fileSize) {
+            close();
+            error = "not a trace file or trace is incomplete";
+            return false;
+        }
+        header.algorithm[sizeof(header.algorithm) - 1] = '\0';
+        return true;
+#else
+        (void)path;
+        error = "traces are not supported on this platform";
+        return false;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (base) munmap(const_cast<unsigned char*>(base), fileSize);
+#endif
+        base = nullptr;
+    }
+
+    size_t elementCount() const { return header.elementCount; }
+    uint64_t stepCount() const { return header.stepCount; }
+    uint64_t position() const { return stepIndex; }
+    std::string algorithm() const { return header.algorithm; }
+
+    // Restores the state after `target` steps from the nearest earlier keyframe.
+    void seek(uint64_t target, std::vector<int>& arr) {
+        target = std::min<uint64_t>(target, header.stepCount);
+        uint64_t lo = 0, hi = header.keyframeCount;
+        while (hi - lo > 1) {
+            uint64_t mid = (lo + hi) / 2;
+            if (readU64(keyframeOffset(mid) + 1) <= target) lo = mid; else hi = mid;
+        }
+        size_t block = keyframeOffset(lo);
+        stepIndex = readU64(block + 1);
+        comparisons = readU64(block + 9);
+        swaps = readU64(block + 17);
+        previousFirst = readU64(block + 25);
+        arr.resize(header.elementCount);
+        std::memcpy(arr.data(), base + block + 33, header.elementCount * sizeof(int32_t));
+        offset = block + keyframeSize();
+        SortStep step;
+        while (stepIndex < target && stepForward(arr, step)) {
+        }
+    }
+
+    bool stepForward(std::vector<int>& arr, SortStep& step) {
+        if (stepIndex >= header.stepCount) return false;
+        while (base[offset] == keyframeMarker) {
+            offset += keyframeSize();
+        }
+        Record record = decode(offset);
+        step.type = record.type;
+        step.worker = record.worker;
+        step.first = previousFirst + record.firstDelta;
+        step.second = step.first + record.secondDelta;
+        if (step.type == StepType::Swap) std::swap(arr[step.first], arr[step.second]);
+        if (step.type == StepType::Write) arr[step.first] += static_cast<int>(record.valueDelta);
+        countStep(step.type, 1);
+        previousFirst = step.first;
+        ++stepIndex;
+        return true;
+    }
+
+    bool stepBackward(std::vector<int>& arr, SortStep& step) {
+        if (stepIndex == 0) return false;
+        while (base[offset - 1] == keyframeMarker) {
+            offset -= keyframeSize();
+        }
+        offset -= base[offset - 1];
+        size_t pos = offset;
+        Record record = decode(pos);
+        step.type = record.type;
+        step.worker = record.worker;
+        step.first = previousFirst;
+        step.second = step.first + record.secondDelta;
+        if (step.type == StepType::Swap) std::swap(arr[step.first], arr[step.second]);
+        if (step.type == StepType::Write) arr[step.first] -= static_cast<int>(record.valueDelta);
+        countStep(step.type, -1);
+        previousFirst = step.first - record.firstDelta;
+        --stepIndex;
+        return true;
+    }
+};
+
+// Fixed-size pool with one task deque per worker. Workers pop their own newest task and steal
+// the oldest task of another worker when they run dry, so recursive fork/join work spreads out.
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    static thread_local const ThreadPool* currentPool;
+    static thread_local int currentIndex;
+
+    void workerLoop(int index) {
+        currentPool = this;
+        currentIndex = index;
+        while (!stopping) {
+            if (!runPendingTask()) {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [this] { return stopping || pending > 0; });
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threadCount = std::max(1u, std::thread::hardware_concurrency())) {
+        threadCount = std::max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back(&ThreadPool::workerLoop, this, static_cast<int>(i));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    size_t size() const { return threads.size(); }
+
+    // Index of the calling worker in this pool, or -1 for any other thread.
+    int workerIndex() const { return currentPool == this ? currentIndex : -1; }
+
+    void submit(std::function<void()> task) {
+        int self = workerIndex();
+        submitTo(self >= 0 ? self : nextQueue++ % queues.size(), std::move(task));
+    }
+
+    // Queues a task on a given worker, which runs its own queue before stealing, so memory the
+    // task touches first is placed on that worker's NUMA node. Idle workers may still steal it.
+    void submitTo(size_t worker, std::function<void()> task) {
+        size_t target = worker % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Runs one queued task on the calling thread. Returns false if there was nothing to run.
+    bool runPendingTask() {
+        std::function<void()> task;
+        int self = workerIndex();
+        if (self >= 0) {
+            std::lock_guard<std::mutex> lock(queues[self]->mutex);
+            if (!queues[self]->tasks.empty()) {
+                task = std::move(queues[self]->tasks.back());
+                queues[self]->tasks.pop_back();
+            }
+        }
+        size_t start = self >= 0 ? self : 0;
+        for (size_t k = 1; !task && k <= queues.size(); ++k) {
+            Queue& victim = *queues[(start + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+        if (!task) return false;
+        pending--;
+        task();
+        return true;
+    }
+};
+
+thread_local const ThreadPool* ThreadPool::currentPool = nullptr;
+thread_local int ThreadPool::currentIndex = -1;
+
+// Hardware-sized pool for work that isn't given a specific one.
+ThreadPool& sharedThreadPool() {
+    static ThreadPool shared;
+    return shared;
+}
+
+// Fork/join scope on a ThreadPool. Tasks may add further tasks to the same group; wait()
+// executes queued tasks on the calling thread until all of them have finished.
+class TaskGroup {
+private:
+    ThreadPool& pool;
+    std::atomic<size_t> pending{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    // Counts the task as finished once it has run, keeping any exception for wait().
+    std::function<void()> wrap(std::function<void()> task) {
+        return [this, task = std::move(task)] {
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                error = std::current_exception();
+            }
+            pending--;
+        };
+    }
+
+public:
+    explicit TaskGroup(ThreadPool& p) : pool(p) {}
+
+    void run(std::function<void()> task) {
+        pending++;
+        pool.submit(wrap(std::move(task)));
+    }
+
+    // Like run(), but queued on a given worker (see ThreadPool::submitTo).
+    void runOn(size_t worker, std::function<void()> task) {
+        pending++;
+        pool.submitTo(worker, wrap(std::move(task)));
+    }
+
+    void wait() {
+        while (pending > 0) {
+            if (!pool.runPendingTask()) {
+                std::this_thread::yield();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// Step produced by a pool worker, carrying the written value so another thread can replay it.
+struct RemoteStep {
+    StepType type;
+    size_t first;
+    size_t second;
+    int value;
+    unsigned worker;
+};
+
+// Bounded hand-off of RemoteSteps from pool workers to the thread driving the SortTask.
+// Producers block while it is full, which paces the workers to the visualization speed.
+class StepQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<RemoteStep> items;
+    size_t capacity;
+    bool cancelled = false;
+    bool finished = false;
+
+public:
+    explicit StepQueue(size_t cap = 4096) : capacity(cap) {}
+
+    void push(const RemoteStep& step) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return cancelled || items.size() < capacity; });
+        if (cancelled) return;
+        items.push_back(step);
+        notEmpty.notify_one();
+    }
+
+    // Blocks until a step is available. Returns false once the producers are finished and
+    // everything has been consumed.
+    bool pop(RemoteStep& step) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return finished || !items.empty(); });
+        if (items.empty()) return false;
+        step = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        notEmpty.notify_all();
+    }
+
+    // Drops everything further pushed so producers run to completion without blocking.
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+        items.clear();
+        notFull.notify_all();
+    }
+
+    void waitFinished() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return finished; });
+    }
+};
+
+// Sink for ParallelSorter that only counts, with one cache line per worker so counting doesn't
+// serialize the threads.
+class CountingSink {
+private:
+    struct alignas(64) Counters {
+        unsigned long long comparisons = 0;
+        unsigned long long swaps = 0;
+    };
+    const ThreadPool& pool;
+    std::vector<Counters> perWorker;
+
+    Counters& local() {
+        int index = pool.workerIndex();
+        return perWorker[index >= 0 ? index : perWorker.size() - 1];
+    }
+
+public:
+    explicit CountingSink(const ThreadPool& p) : pool(p), perWorker(p.size() + 1) {}
+
+    void compare(size_t, size_t) { local().comparisons++; }
+    void swap(size_t, size_t) { local().swaps++; }
+    template <typename V>
+    void write(size_t, const V&) { local().swaps++; }
+
+    unsigned long long comparisons() const {
+        unsigned long long total = 0;
+        for (const auto& c : perWorker) total += c.comparisons;
+        return total;
+    }
+
+    unsigned long long swaps() const {
+        unsigned long long total = 0;
+        for (const auto& c : perWorker) total += c.swaps;
+        return total;
+    }
+};
+
+// Sink for ParallelSorter that forwards every step, tagged with its worker, to a StepQueue.
+class StreamSink {
+private:
+    const ThreadPool& pool;
+    StepQueue& queue;
+
+    unsigned worker() const { return pool.workerIndex() + 1; }
+
+public:
+    StreamSink(const ThreadPool& p, StepQueue& q) : pool(p), queue(q) {}
+
+    void compare(size_t a, size_t b) { queue.push({StepType::Compare, a, b, 0, worker()}); }
+    void swap(size_t a, size_t b) { queue.push({StepType::Swap, a, b, 0, worker()}); }
+    void write(size_t index, int value) { queue.push({StepType::Write, index, index, value, worker()}); }
+};
+
+// Parallel merge sort, quicksort and sample sort over a raw array on a ThreadPool, ordered by `before`.
+// Every compare, swap and write is reported to the Sink using indices into `data`.
+template <class Sink, class T = int, class Before = std::less<>>
+class ParallelSorter {
+private:
+    ThreadPool& pool;
+    T* data;
+    T* tmp; // Same length as data
+    size_t n;
+    Sink& sink;
+    Before before;
+    size_t grain; // Ranges at most this long are handled by one task
+
+    void insertionSort(size_t lo, size_t hi) {
+        for (size_t i = lo + 1; i < hi; ++i) {
+            T key = data[i];
+            size_t j = i;
+            while (j > lo) {
+                sink.compare(j - 1, i);
+                if (!before(key, data[j - 1])) break;
+                data[j] = data[j - 1];
+                sink.write(j, data[j]);
+                --j;
+            }
+            if (j != i) {
+                data[j] = key;
+                sink.write(j, key);
+            }
+        }
+    }
+
+    // Merges tmp[aLo, aHi) and tmp[bLo, bHi) into data starting at out.
+    void mergeRuns(size_t aLo, size_t aHi, size_t bLo, size_t bHi, size_t out) {
+        while (aLo < aHi && bLo < bHi) {
+            sink.compare(aLo, bLo);
+            T value = before(tmp[bLo], tmp[aLo]) ? tmp[bLo++] : tmp[aLo++];
+            data[out] = value;
+            sink.write(out++, value);
+        }
+        while (aLo < aHi) {
+            data[out] = tmp[aLo++];
+            sink.write(out, data[out]);
+            ++out;
+        }
+        while (bLo < bHi) {
+            data[out] = tmp[bLo++];
+            sink.write(out, data[out]);
+            ++out;
+        }
+    }
+
+    void sequentialMergeSort(size_t lo, size_t hi) {
+        if (hi - lo <= 16) {
+            insertionSort(lo, hi);
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        sequentialMergeSort(lo, mid);
+        sequentialMergeSort(mid, hi);
+        std::copy(data + lo, data + hi, tmp + lo);
+        mergeRuns(lo, mid, mid, hi, lo);
+    }
+
+    // Number of elements of tmp[aLo, aHi) among the first `diagonal` outputs of the stable
+    // merge of tmp[aLo, aHi) and tmp[bLo, bHi).
+    size_t mergePathSplit(size_t aLo, size_t aHi, size_t bLo, size_t bHi, size_t diagonal) const {
+        size_t na = aHi - aLo, nb = bHi - bLo;
+        size_t lo = diagonal > nb ? diagonal - nb : 0;
+        size_t hi = std::min(diagonal, na);
+        while (lo < hi) {
+            size_t i = lo + (hi - lo) / 2;
+            if (!before(tmp[bLo + diagonal - i - 1], tmp[aLo + i])) {
+                lo = i + 1;
+            } else {
+                hi = i;
+            }
+        }
+        return lo;
+    }
+
+    // Merges the sorted halves [lo, mid) and [mid, hi) of data. Both halves are copied to tmp in
+    // parallel, then the output is cut into equal slices along the merge path and each slice is
+    // merged by its own task.
+    void parallelMerge(size_t lo, size_t mid, size_t hi) {
+        size_t total = hi - lo;
+        size_t parts = std::min((total + grain - 1) / grain, pool.size() * 4);
+        if (parts <= 1) {
+            std::copy(data + lo, data + hi, tmp + lo);
+            mergeRuns(lo, mid, mid, hi, lo);
+            return;
+        }
+        TaskGroup copies(pool);
+        for (size_t p = 1; p < parts; ++p) {
+            size_t from = lo + total * p / parts, to = lo + total * (p + 1) / parts;
+            copies.run([=, this] { std::copy(data + from, data + to, tmp + from); });
+        }
+        std::copy(data + lo, data + lo + total / parts, tmp + lo);
+        copies.wait();
+
+        TaskGroup slices(pool);
+        auto mergeSlice = [=, this](size_t p) {
+            size_t d0 = total * p / parts, d1 = total * (p + 1) / parts;
+            size_t i0 = mergePathSplit(lo, mid, mid, hi, d0);
+            size_t i1 = mergePathSplit(lo, mid, mid, hi, d1);
+            mergeRuns(lo + i0, lo + i1, mid + (d0 - i0), mid + (d1 - i1), lo + d0);
+        };
+        for (size_t p = 1; p < parts; ++p) {
+            slices.run([=] { mergeSlice(p); });
+        }
+        mergeSlice(0);
+        slices.wait();
+    }
+
+    void mergeSortRange(size_t lo, size_t hi) {
+        if (hi - lo <= grain) {
+            sequentialMergeSort(lo, hi);
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        TaskGroup group(pool);
+        group.run([=, this] { mergeSortRange(lo, mid); });
+        mergeSortRange(mid, hi);
+        group.wait();
+        parallelMerge(lo, mid, hi);
+    }
+
+    // Hoare partition around the median of three, moved to lo first. Returns s with
+    // [lo, s) <= pivot <= [s, hi), both sides non-empty.
+    size_t partition(size_t lo, size_t hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t last = hi - 1;
+        sink.compare(lo, mid);
+        if (before(data[mid], data[lo])) { std::swap(data[mid], data[lo]); sink.swap(mid, lo); }
+        sink.compare(mid, last);
+        if (before(data[last], data[mid])) { std::swap(data[last], data[mid]); sink.swap(last, mid); }
+        sink.compare(lo, mid);
+        if (before(data[mid], data[lo])) { std::swap(data[mid], data[lo]); sink.swap(mid, lo); }
+        std::swap(data[lo], data[mid]);
+        sink.swap(lo, mid);
+        T pivot = data[lo];
+        size_t i = lo - 1, j = hi;
+        while (true) {
+            do { ++i; sink.compare(i, lo); } while (before(data[i], pivot));
+            do { --j; sink.compare(j, lo); } while (before(pivot, data[j]));
+            if (i >= j) return j + 1;
+            std::swap(data[i], data[j]);
+            sink.swap(i, j);
+        }
+    }
+
+    void sequentialQuickSort(size_t lo, size_t hi) {
+        while (hi - lo > 16) {
+            size_t split = partition(lo, hi);
+            if (split - lo < hi - split) {
+                sequentialQuickSort(lo, split);
+                lo = split;
+            } else {
+                sequentialQuickSort(split, hi);
+                hi = split;
+            }
+        }
+        insertionSort(lo, hi);
+    }
+
+    // Partitions while the range is above the grain, handing the smaller side to another task
+    // and continuing on the larger one.
+    void quickSortRange(TaskGroup& group, size_t lo, size_t hi) {
+        while (hi - lo > grain) {
+            size_t split = partition(lo, hi);
+            if (split - lo < hi - split) {
+                group.run([=, this, &group] { quickSortRange(group, lo, split); });
+                lo = split;
+            } else {
+                group.run([=, this, &group] { quickSortRange(group, split, hi); });
+                hi = split;
+            }
+        }
+        sequentialQuickSort(lo, hi);
+    }
+
+    static constexpr size_t oversample = 16; // Sample elements per splitter
+    static constexpr size_t maxSplitters = 127; // So the 2m + 1 bucket ids fit in a byte
+
+    // Bucket of data[index]: 2i if it lies between splitters i - 1 and i, 2i + 1 if it equals
+    // splitter i. The splitters live outside data, so each probe is shown as a compare of the
+    // element with itself.
+    size_t classify(size_t index, const std::vector<T>& splitters) {
+        const T& value = data[index];
+        size_t lo = 0, hi = splitters.size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            sink.compare(index, index);
+            if (before(splitters[mid], value)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        sink.compare(index, index);
+        bool equal = lo < splitters.size() && !before(value, splitters[lo]);
+        return 2 * lo + equal;
+    }
+
+public:
+    ParallelSorter(ThreadPool& p, T* d, T* t, size_t size, Sink& s, Before order = Before())
+        : pool(p), data(d), tmp(t), n(size), sink(s), before(order),
+          grain(std::max<size_t>(size / (p.size() * 8), 16)) {}
+
+    void mergeSort() {
+        if (n > 1) mergeSortRange(0, n);
+    }
+
+    void quickSort() {
+        if (n <= 1) return;
+        TaskGroup group(pool);
+        quickSortRange(group, 0, n);
+        group.wait();
+    }
+
+    // Sample sort: splitters are every `oversample`-th element of a sorted random sample, and
+    // keys equal to a splitter get a bucket of their own that needs no sorting. Stripes of data
+    // are classified in parallel into local histograms, a prefix sum gives every stripe its slots
+    // in each bucket, and the stripes scatter into tmp in parallel. Each bucket is then sorted
+    // in tmp and copied back by a task queued on the worker whose share of the output it starts
+    // in; that worker also touched the bucket's pages of tmp first, so with first-touch placement
+    // the sort runs on memory of its own NUMA node.
+    void sampleSort() {
+        const size_t workers = pool.size();
+        const size_t wanted = std::min({maxSplitters, std::max<size_t>(workers * 4, n >> 20), n / (4 * oversample)});
+        if (wanted == 0) {
+            quickSort();
+            return;
+        }
+        std::vector<T> sample(oversample * (wanted + 1));
+        uint64_t state = n;
+        for (T& element : sample) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL; // Knuth's MMIX LCG
+            element = data[(state >> 11) % n];
+        }
+        std::sort(sample.begin(), sample.end(), before);
+        std::vector<T> splitters;
+        for (size_t i = 1; i <= wanted; ++i) {
+            const T& candidate = sample[i * oversample];
+            if (splitters.empty() || before(splitters.back(), candidate)) splitters.push_back(candidate);
+        }
+        const size_t buckets = 2 * splitters.size() + 1;
+        const size_t stride = (buckets + 7) & ~size_t(7); // Histograms of different stripes on separate cache lines
+        const size_t stripes = workers;
+        auto stripeBegin = [&](size_t s) { return n * s / stripes; };
+
+        std::vector<uint8_t> oracle(n); // Bucket of every element, so the scatter needn't classify again
+        std::vector<size_t> slots(stripes * stride, 0);
+        TaskGroup classifying(pool);
+        for (size_t s = 0; s < stripes; ++s) {
+            classifying.run([&, s] {
+                size_t* counts = &slots[s * stride];
+                for (size_t i = stripeBegin(s); i < stripeBegin(s + 1); ++i) {
+                    size_t b = classify(i, splitters);
+                    oracle[i] = static_cast<uint8_t>(b);
+                    ++counts[b];
+                }
+            });
+        }
+        classifying.wait();
+
+        // Bucket-major prefix sum: slots[s][b] becomes where stripe s writes its first element of b.
+        std::vector<size_t> bucketStart(buckets + 1);
+        size_t sum = 0;
+        for (size_t b = 0; b < buckets; ++b) {
+            bucketStart[b] = sum;
+            for (size_t s = 0; s < stripes; ++s) {
+                size_t count = slots[s * stride + b];
+                slots[s * stride + b] = sum;
+                sum += count;
+            }
+        }
+        bucketStart[buckets] = n;
+        auto owner = [&](size_t b) { return std::min(bucketStart[b] * workers / n, workers - 1); };
+
+        const size_t pageElements = std::max<size_t>(4096 / sizeof(T), 1);
+        TaskGroup touching(pool);
+        for (size_t b = 0; b < buckets; ++b) {
+            touching.runOn(owner(b), [&, b] {
+                for (size_t i = bucketStart[b]; i < bucketStart[b + 1]; i += pageElements) tmp[i] = T();
+            });
+        }
+        touching.wait();
+
+        TaskGroup scattering(pool);
+        for (size_t s = 0; s < stripes; ++s) {
+            scattering.run([&, s] {
+                size_t* next = &slots[s * stride];
+                for (size_t i = stripeBegin(s); i < stripeBegin(s + 1); ++i) {
+                    size_t slot = next[oracle[i]]++;
+                    tmp[slot] = data[i];
+                    sink.write(slot, data[i]);
+                }
+            });
+        }
+        scattering.wait();
+
+        // Steps of the bucket sorts use the same indices as data, which tmp now mirrors.
+        TaskGroup sorting(pool);
+        for (size_t b = 0; b < buckets; ++b) {
+            sorting.runOn(owner(b), [&, b] {
+                size_t lo = bucketStart[b], hi = bucketStart[b + 1];
+                if (b % 2 == 0 && hi - lo > 1) {
+                    ParallelSorter inTmp(pool, tmp, data, n, sink, before);
+                    inTmp.sequentialQuickSort(lo, hi);
+                }
+                std::copy(tmp + lo, tmp + hi, data + lo);
+            });
+        }
+        sorting.wait();
+    }
+};
+
+// Bitonic sorting networks for blocks of up to 64 ints and a merge of two sorted runs, with
+// AVX2 and SSE4.1 versions chosen at runtime and a scalar fallback.
+class SortingNetwork {
+public:
+    enum class Isa { Scalar, Sse41, Avx2 };
+    static constexpr size_t maxBlock = 64;
+
+private:
+    static Isa& selected() {
+        static Isa isa = detect();
+        return isa;
+    }
+
+    static Isa detect() {
+#ifdef SORTING_NETWORK_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return Isa::Avx2;
+        if (__builtin_cpu_supports("sse4.1")) return Isa::Sse41;
+#endif
+        return Isa::Scalar;
+    }
+
+    // Network over a power-of-two length; the sign of (i & k) picks the direction.
+    static void bitonicScalar(int* v, size_t n) {
+        for (size_t k = 2; k <= n; k <<= 1) {
+            for (size_t j = k >> 1; j > 0; j >>= 1) {
+                for (size_t i = 0; i < n; ++i) {
+                    size_t l = i ^ j;
+                    if (l > i && ((v[i] > v[l]) == ((i & k) == 0))) {
+                        std::swap(v[i], v[l]);
+                    }
+                }
+            }
+        }
+    }
+
+    static size_t mergeScalar(const int* a, size_t na, const int* b, size_t nb, int* out) {
+        size_t i = 0, j = 0, o = 0, compares = 0;
+        while (i < na && j < nb) {
+            ++compares;
+            out[o++] = a[i] <= b[j] ? a[i++] : b[j++];
+        }
+        while (i < na) out[o++] = a[i++];
+        while (j < nb) out[o++] = b[j++];
+        return compares;
+    }
+
+    // Finishes a vector merge: `rest` holds sorted values no smaller than anything already
+    // written, and the remainders of a and b are merged in with it.
+    static size_t mergeTail(const int* rest, size_t nr, const int* a, size_t na, const int* b, size_t nb, int* out) {
+        size_t r = 0, i = 0, j = 0, compares = 0;
+        while (r < nr || i < na || j < nb) {
+            const int* pick = nullptr;
+            size_t* cursor = nullptr;
+            if (r < nr) { pick = rest + r; cursor = &r; }
+            if (i < na && (!pick || (++compares, a[i] < *pick))) { pick = a + i; cursor = &i; }
+            if (j < nb && (!pick || (++compares, b[j] < *pick))) { pick = b + j; cursor = &j; }
+            *out++ = *pick;
+            ++*cursor;
+        }
+        return compares;
+    }
+
+#ifdef SORTING_NETWORK_X86
+    __attribute__((target("avx2"))) static void bitonicAvx2(int* v, size_t n) {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        for (size_t k = 2; k <= n; k <<= 1) {
+            for (size_t j = k >> 1; j > 0; j >>= 1) {
+                if (j >= 8) {
+                    for (size_t b = 0; b < n; b += 8) {
+                        if (b & j) continue;
+                        __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(v + b));
+                        __m256i y = _mm256_load_si256(reinterpret_cast<const __m256i*>(v + b + j));
+                        __m256i lo = _mm256_min_epi32(x, y), hi = _mm256_max_epi32(x, y);
+                        bool ascending = (b & k) == 0;
+                        _mm256_store_si256(reinterpret_cast<__m256i*>(v + b), ascending ? lo : hi);
+                        _mm256_store_si256(reinterpret_cast<__m256i*>(v + b + j), ascending ? hi : lo);
+                    }
+                    continue;
+                }
+                const __m256i partner = _mm256_xor_si256(lane, _mm256_set1_epi32(j));
+                const __m256i jMask = _mm256_set1_epi32(j), kMask = _mm256_set1_epi32(k);
+                for (size_t b = 0; b < n; b += 8) {
+                    __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(v + b));
+                    __m256i p = _mm256_permutevar8x32_epi32(x, partner);
+                    __m256i index = _mm256_add_epi32(lane, _mm256_set1_epi32(b));
+                    __m256i lower = _mm256_cmpeq_epi32(_mm256_and_si256(index, jMask), _mm256_setzero_si256());
+                    __m256i ascending = _mm256_cmpeq_epi32(_mm256_and_si256(index, kMask), _mm256_setzero_si256());
+                    __m256i takeMin = _mm256_cmpeq_epi32(lower, ascending);
+                    __m256i result = _mm256_blendv_epi8(_mm256_max_epi32(x, p), _mm256_min_epi32(x, p), takeMin);
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(v + b), result);
+                }
+            }
+        }
+    }
+
+    // Sorts the 16 values in (a, b) so that a holds the smallest 8 and b the largest 8.
+    __attribute__((target("avx2"))) static void mergeNetworkAvx2(__m256i& a, __m256i& b) {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+        __m256i lo = _mm256_min_epi32(a, b), hi = _mm256_max_epi32(a, b);
+        for (int j = 4; j > 0; j >>= 1) {
+            const __m256i partner = _mm256_xor_si256(lane, _mm256_set1_epi32(j));
+            const __m256i lower = _mm256_cmpeq_epi32(_mm256_and_si256(lane, _mm256_set1_epi32(j)), _mm256_setzero_si256());
+            __m256i p = _mm256_permutevar8x32_epi32(lo, partner);
+            lo = _mm256_blendv_epi8(_mm256_max_epi32(lo, p), _mm256_min_epi32(lo, p), lower);
+            p = _mm256_permutevar8x32_epi32(hi, partner);
+            hi = _mm256_blendv_epi8(_mm256_max_epi32(hi, p), _mm256_min_epi32(hi, p), lower);
+        }
+        a = lo;
+        b = hi;
+    }
+
+    __attribute__((target("avx2"))) static size_t mergeAvx2(const int* a, size_t na, const int* b, size_t nb, int* out) {
+        if (na < 8 || nb < 8) return mergeScalar(a, na, b, nb, out);
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+        size_t i = 8, j = 8, o = 0, compares = 0;
+        while (true) {
+            mergeNetworkAvx2(low, high);
+            compares += 32;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), low);
+            o += 8;
+            // Continue with the run whose next value is smaller; stop once it has no full chunk.
+            bool fromA = j >= nb || (i < na && a[i] <= b[j]);
+            if (fromA && i + 8 <= na) {
+                low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                i += 8;
+            } else if (!fromA && j + 8 <= nb) {
+                low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+                j += 8;
+            } else {
+                break;
+            }
+        }
+        alignas(32) int rest[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(rest), high);
+        return compares + mergeTail(rest, 8, a + i, na - i, b + j, nb - j, out + o);
+    }
+
+    __attribute__((target("sse4.1"))) static __m128i compareExchangeSse41(__m128i x, int j, int k, size_t base) {
+        __m128i p = j == 2 ? _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)) : _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128i index = _mm_add_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(base));
+        __m128i lower = _mm_cmpeq_epi32(_mm_and_si128(index, _mm_set1_epi32(j)), _mm_setzero_si128());
+        __m128i ascending = _mm_cmpeq_epi32(_mm_and_si128(index, _mm_set1_epi32(k)), _mm_setzero_si128());
+        return _mm_blendv_epi8(_mm_max_epi32(x, p), _mm_min_epi32(x, p), _mm_cmpeq_epi32(lower, ascending));
+    }
+
+    __attribute__((target("sse4.1"))) static void bitonicSse41(int* v, size_t n) {
+        for (size_t k = 2; k <= n; k <<= 1) {
+            for (size_t j = k >> 1; j > 0; j >>= 1) {
+                for (size_t b = 0; b < n; b += 4) {
+                    if (j >= 4) {
+                        if (b & j) continue;
+                        __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(v + b));
+                        __m128i y = _mm_load_si128(reinterpret_cast<const __m128i*>(v + b + j));
+                        __m128i lo = _mm_min_epi32(x, y), hi = _mm_max_epi32(x, y);
+                        bool ascending = (b & k) == 0;
+                        _mm_store_si128(reinterpret_cast<__m128i*>(v + b), ascending ? lo : hi);
+                        _mm_store_si128(reinterpret_cast<__m128i*>(v + b + j), ascending ? hi : lo);
+                    } else {
+                        __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(v + b));
+                        _mm_store_si128(reinterpret_cast<__m128i*>(v + b), compareExchangeSse41(x, j, k, b));
+                    }
+                }
+            }
+        }
+    }
+
+    // Sorts the 8 values in (a, b) so that a holds the smallest 4 and b the largest 4.
+    __attribute__((target("sse4.1"))) static void mergeNetworkSse41(__m128i& a, __m128i& b) {
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));
+        __m128i lo = _mm_min_epi32(a, b), hi = _mm_max_epi32(a, b);
+        lo = compareExchangeSse41(lo, 2, 8, 0);
+        lo = compareExchangeSse41(lo, 1, 8, 0);
+        hi = compareExchangeSse41(hi, 2, 8, 0);
+        hi = compareExchangeSse41(hi, 1, 8, 0);
+        a = lo;
+        b = hi;
+    }
+
+    __attribute__((target("sse4.1"))) static size_t mergeSse41(const int* a, size_t na, const int* b, size_t nb, int* out) {
+        if (na < 4 || nb < 4) return mergeScalar(a, na, b, nb, out);
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+        size_t i = 4, j = 4, o = 0, compares = 0;
+        while (true) {
+            mergeNetworkSse41(low, high);
+            compares += 12;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), low);
+            o += 4;
+            bool fromA = j >= nb || (i < na && a[i] <= b[j]);
+            if (fromA && i + 4 <= na) {
+                low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                i += 4;
+            } else if (!fromA && j + 4 <= nb) {
+                low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+                j += 4;
+            } else {
+                break;
+            }
+        }
+        alignas(16) int rest[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(rest), high);
+        return compares + mergeTail(rest, 4, a + i, na - i, b + j, nb - j, out + o);
+    }
+#endif
+
+public:
+    static Isa isa() { return selected(); }
+
+    // Forces a narrower instruction set, e.g. to compare kernels. Never widens past the CPU.
+    static void setIsa(Isa isa) { selected() = std::min(isa, detect()); }
+
+    static const char* isaName() {
+        switch (selected()) {
+            case Isa::Avx2: return "AVX2";
+            case Isa::Sse41: return "SSE4.1";
+            default: return "scalar";
+        }
+    }
+
+    // Padded network length for a block of n values: the next power of two, at least 8.
+    static size_t paddedLength(size_t n) {
+        size_t m = 8;
+        while (m < n) m <<= 1;
+        return m;
+    }
+
+    // Compare-exchanges performed by sortBlock(n).
+    static size_t comparators(size_t n) {
+        size_t m = paddedLength(n), stages = 0;
+        for (size_t k = 2; k <= m; k <<= 1) {
+            for (size_t j = k >> 1; j > 0; j >>= 1) ++stages;
+        }
+        return stages * m / 2;
+    }
+
+    // Sorts up to maxBlock values in place. The block is padded with INT_MAX to the network length.
+    static void sortBlock(int* data, size_t n) {
+        alignas(32) int buffer[maxBlock];
+        size_t m = paddedLength(n);
+        std::copy(data, data + n, buffer);
+        std::fill(buffer + n, buffer + m, INT_MAX);
+        switch (selected()) {
+#ifdef SORTING_NETWORK_X86
+            case Isa::Avx2: bitonicAvx2(buffer, m); break;
+            case Isa::Sse41: bitonicSse41(buffer, m); break;
+#endif
+            default: bitonicScalar(buffer, m); break;
+        }
+        std::copy(buffer, buffer + n, data);
+    }
+
+    // Merges two sorted runs into out. Returns the number of comparisons, counting
+    // every lane of a vector min/max.
+    static size_t mergeRuns(const int* a, size_t na, const int* b, size_t nb, int* out) {
+        switch (selected()) {
+#ifdef SORTING_NETWORK_X86
+            case Isa::Avx2: return mergeAvx2(a, na, b, nb, out);
+            case Isa::Sse41: return mergeSse41(a, na, b, nb, out);
+#endif
+            default: return mergeScalar(a, na, b, nb, out);
+        }
+    }
+};
+
+// Hints that `address` will be read soon. A no-op for compilers without the builtin.
+inline void prefetchRead(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#else
+    (void)address;
+#endif
+}
+
+// Bump allocator for an algorithm's temporary buffers. A sort reserves its worst case once
+// when it starts, so nothing is allocated while it runs; Scope hands space back on exit.
+class ScratchArena {
+public:
+    // Makes room for at least `bytes` and forgets all earlier allocations.
+    void reset(size_t bytes) {
+        if (bytes > capacity) {
+            storage.reset(new std::byte[bytes]);
+            capacity = bytes;
+        }
+        used = 0;
+    }
+
+    template <typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "the arena never runs constructors");
+        size_t offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (count > (capacity - std::min(offset, capacity)) / sizeof(T)) throw std::bad_alloc();
+        used = offset + count * sizeof(T);
+        return reinterpret_cast<T*>(storage.get() + offset);
+    }
+
+    class Scope {
+    public:
+        explicit Scope(ScratchArena& arena) : arena(arena), mark(arena.used) {}
+        ~Scope() { arena.used = mark; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ScratchArena& arena;
+        size_t mark;
+    };
+
+private:
+    std::unique_ptr<std::byte[]> storage;
+    size_t capacity = 0;
+    size_t used = 0;
+};
+
+// Elements that are their own sort key.
+template <typename T>
+struct IdentityKey {
+    const T& operator()(const T& value) const { return value; }
+};
+
+// Maps an arithmetic key to unsigned bits that sort in the same order: signed integers get
+// their sign bit flipped, negative floats all their bits and non-negative floats the sign bit.
+// NaNs end up at either end depending on their sign.
+template <typename Key>
+struct RadixKey {
+    using Bits = std::conditional_t<sizeof(Key) <= 4, uint32_t, uint64_t>;
+
+    static Bits encode(Key key) {
+        if constexpr (std::is_floating_point_v<Key>) {
+            static_assert(sizeof(Key) == sizeof(Bits), "unsupported floating-point width");
+            Bits bits;
+            std::memcpy(&bits, &key, sizeof bits);
+            const Bits sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+            return bits & sign ? ~bits : bits | sign;
+        } else {
+            Bits bits = static_cast<std::make_unsigned_t<Key>>(key);
+            if constexpr (std::is_signed_v<Key>) bits ^= Bits(1) << (sizeof(Key) * 8 - 1);
+            return bits;
+        }
+    }
+};
+
+// Set-associative cache hierarchy with LRU replacement, fed with the addresses a sort touches.
+// Levels are looked up in order and a miss fills the line into every level that missed; writes
+// allocate like reads. It sees only the sort's own accesses in the order its steps report them,
+// so it explains an algorithm's memory behavior rather than predicting the hardware exactly.
+class CacheSimulator {
+public:
+    struct LevelConfig {
+        std::string name;
+        size_t bytes;
+        unsigned ways;
+    };
+
+    struct Level {
+        std::string name;
+        size_t sets;
+        unsigned ways;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        std::vector<uint64_t> lines; // sets x ways line addresses, emptyLine when free
+        std::vector<uint64_t> lastUse; // Access clock of each way, for LRU
+    };
+
+    // 32K 8-way L1, 1M 16-way L2 and 32M 16-way LLC: a typical current desktop core.
+    static std::vector<LevelConfig> defaultLevels() {
+        return {{"L1", 32 << 10, 8}, {"L2", 1 << 20, 16}, {"LLC", 32 << 20, 16}};
+    }
+
+    explicit CacheSimulator(const std::vector<LevelConfig>& configs, unsigned lineBytes = 64) : lineShift(std::countr_zero(std::bit_ceil(std::max(lineBytes, 1u)))) {
+        for (const LevelConfig& config : configs) {
+            Level level;
+            level.name = config.name;
+            level.ways = std::max(config.ways, 1u);
+            level.sets = std::max<size_t>(config.bytes >> lineShift, 1) / level.ways;
+            level.sets = std::max<size_t>(level.sets, 1);
+            levelList.push_back(std::move(level));
+        }
+        clear();
+    }
+
+    // Empties every level and zeroes the statistics.
+    void clear() {
+        for (Level& level : levelList) {
+            level.hits = level.misses = 0;
+            level.lines.assign(level.sets * level.ways, emptyLine);
+            level.lastUse.assign(level.sets * level.ways, 0);
+        }
+        clock = 0;
+    }
+
+    // Returns the 1-based level that held the line, or levels().size() + 1 for memory.
+    unsigned access(const void* address) {
+        uint64_t line = reinterpret_cast<uintptr_t>(address) >> lineShift;
+        ++clock;
+        for (size_t l = 0; l < levelList.size(); ++l) {
+            if (lookup(levelList[l], line)) return static_cast<unsigned>(l + 1);
+        }
+        return static_cast<unsigned>(levelList.size() + 1);
+    }
+
+    const std::vector<Level>& levels() const { return levelList; }
+    unsigned lineBytes() const { return 1u << lineShift; }
+
+private:
+    static constexpr uint64_t emptyLine = UINT64_MAX;
+    std::vector<Level> levelList;
+    unsigned lineShift;
+    uint64_t clock = 0;
+
+    // Counts a hit or a miss; on a miss the least recently used way of the set takes the line.
+    bool lookup(Level& level, uint64_t line) {
+        size_t base = (line % level.sets) * level.ways;
+        size_t victim = base;
+        for (size_t w = base; w < base + level.ways; ++w) {
+            if (level.lines[w] == line) {
+                level.lastUse[w] = clock;
+                ++level.hits;
+                return true;
+            }
+            if (level.lastUse[w] < level.lastUse[victim]) victim = w;
+        }
+        level.lines[victim] = line;
+        level.lastUse[victim] = clock;
+        ++level.misses;
+        return false;
+    }
+};
+
+// Operation counter that one thread bumps and others may read while it runs. Relaxed loads and
+// stores compile to plain moves, so counting costs no more than an unsigned long long.
+class StepCounter {
+public:
+    StepCounter& operator=(unsigned long long v) {
+        value.store(v, std::memory_order_relaxed);
+        return *this;
+    }
+    StepCounter& operator+=(unsigned long long v) {
+        value.store(value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        return *this;
+    }
+    StepCounter& operator++() { return *this += 1; }
+    void operator++(int) { *this += 1; }
+    operator unsigned long long() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned long long> value{0};
+};
+
+// Owns the array and counters and implements every algorithm as a SortTask over elements of
+// type T, ordered by Less applied to the keys KeyOf extracts. Has no knowledge of rendering;
+// the visualizer pulls steps and draws them. Traces can only be recorded for plain ints.
+template <typename T, typename KeyOf = IdentityKey<T>, typename Less = std::less<>>
+class BasicSortEngine {
+public:
+    using Key = std::decay_t<std::invoke_result_t<const KeyOf&, const T&>>;
+
+    // Comparator on whole elements, also handed to ParallelSorter.
+    struct Before {
+        KeyOf keyOf;
+        Less less;
+        bool operator()(const T& a, const T& b) const { return less(keyOf(a), keyOf(b)); }
+    };
+
+private:
+    // Plain ascending ints can use the SIMD kernels and be traced.
+    static constexpr bool plainInts = std::is_same_v<T, int> && std::is_same_v<KeyOf, IdentityKey<int>> && std::is_same_v<Less, std::less<>>;
+    // Radix and counting sort need the natural order of an arithmetic key.
+    static constexpr bool naturalOrder = std::is_arithmetic_v<Key> && std::is_same_v<Less, std::less<>>;
+
+    ScratchArena scratch; // Temporary storage for the running sort
+
+    bool before(const T& a, const T& b) const { return less(keyOf(a), keyOf(b)); }
+
+    // Every step passes through here so an attached trace or cache simulator sees it.
+    SortStep emit(const SortStep& step, int64_t delta = 0) {
+        if constexpr (plainInts) {
+            if (trace && trace->record(step, delta)) {
+                trace->writeKeyframe(arr, comparisons, swaps);
+            }
+        }
+        if (cache) return simulate(step);
+        return step;
+    }
+
+    // Feeds the array elements a step touches to the cache simulator: compares and swaps touch
+    // both indices, reads and writes one.
+    SortStep simulate(SortStep step) {
+        bool both = step.type == StepType::Compare || step.type == StepType::Swap;
+        if ((both || step.type == StepType::Read || step.type == StepType::Write) && step.first < arr.size()) {
+            step.cacheLevel[0] = step.cacheLevel[1] = static_cast<uint8_t>(cache->access(&arr[step.first]));
+            if (both && step.second < arr.size()) {
+                step.cacheLevel[1] = static_cast<uint8_t>(cache->access(&arr[step.second]));
+            }
+        }
+        return step;
+    }
+
+    // An access outside arr (a merge buffer, a count array), seen only by the cache simulator.
+    void touch(const void* address) {
+        if (cache) cache->access(address);
+    }
+
+    SortStep compare(size_t a, size_t b, unsigned worker = 0) {
+        comparisons++;
+        return emit({StepType::Compare, a, b, worker});
+    }
+
+    SortStep swapAt(size_t a, size_t b, unsigned worker = 0) {
+        std::swap(arr[a], arr[b]);
+        swaps++;
+        return emit({StepType::Swap, a, b, worker});
+    }
+
+    SortStep write(size_t index, const T& value, unsigned worker = 0) {
+        int64_t delta = 0;
+        if constexpr (plainInts) delta = static_cast<int64_t>(value) - arr[index];
+        arr[index] = value;
+        swaps++;
+        return emit({StepType::Write, index, index, worker}, delta);
+    }
+
+    SortStep read(size_t index) { return emit({StepType::Read, index, index}); }
+    SortStep pivot(size_t index) { return emit({StepType::Pivot, index, index}); }
+    SortStep runSpan(size_t first, size_t last) { return emit({StepType::Run, first, last}); }
+
+public:
+    std::vector<T> arr;
+    KeyOf keyOf;
+    Less less;
+    StepCounter comparisons; // Readable from other threads while the sort runs
+    StepCounter swaps;
+    TraceWriter* trace = nullptr; // Records every step when set; ignored unless plainInts
+    CacheSimulator* cache = nullptr; // Fed every array access when set; needs observed for the block partition and parallel sorts
+    ThreadPool* pool = nullptr; // Used by the parallel algorithms; a shared hardware-sized pool if unset
+    bool observed = false; // Set when every step is consumed, e.g. by the visualizer
+    unsigned radixBits = 8; // Digit width for radix sort: 8 (four passes) or 11 (three passes)
+    unsigned heapArity = 2; // Children per node in heap sort's heap: 2, 4 or 8
+    size_t selectCount = 0; // k of the selection algorithms; the median if 0 or above n
+
+    void resetCounters() {
+        comparisons = 0;
+        swaps = 0;
+    }
+
+    ThreadPool& threadPool() {
+        if (!pool) pool = &sharedThreadPool();
+        return *pool;
+    }
+
+    SortTask bubbleSort() {
+        for (size_t i = 0; i + 1 < arr.size(); ++i) {
+            bool swapped = false;
+            for (size_t j = 0; j < arr.size() - i - 1; ++j) {
+                co_yield compare(j, j + 1);
+                if (before(arr[j + 1], arr[j])) {
+                    co_yield swapAt(j, j + 1);
+                    swapped = true;
+                }
+            }
+            if (!swapped) break;
+        }
+    }
+
+    SortTask selectionSort() {
+        for (size_t i = 0; i + 1 < arr.size(); ++i) {
+            size_t minIdx = i;
+            co_yield pivot(minIdx);
+            for (size_t j = i + 1; j < arr.size(); ++j) {
+                co_yield compare(j, minIdx);
+                if (before(arr[j], arr[minIdx])) {
+                    minIdx = j;
+                    co_yield pivot(minIdx);
+                }
+            }
+            if (minIdx != i) {
+                co_yield swapAt(i, minIdx);
+            }
+        }
+    }
+
+    SortTask insertionSort() {
+        for (size_t i = 1; i < arr.size(); ++i) {
+            T key = arr[i];
+            size_t j = i;
+            while (j > 0) {
+                co_yield compare(j - 1, j);
+                if (!before(key, arr[j - 1])) break;
+                co_yield write(j, arr[j - 1]);
+                --j;
+            }
+            if (j != i) {
+                co_yield write(j, key);
+            }
+        }
+    }
+
+    // Base case for the divide-and-conquer sorts. Unwatched plain ints are sorted in registers
+    // by the sorting network, so only the stores show up as steps and its compare-exchanges
+    // are counted in bulk. Watched or recorded blocks, and other element types, are insertion
+    // sorted so that every compare is a step.
+    SortTask networkSort(size_t first, size_t last) {
+        size_t n = last - first;
+        if (n < 2) co_return;
+        if constexpr (plainInts) {
+            if (!observed && !trace) {
+                int block[SortingNetwork::maxBlock];
+                std::copy(arr.begin() + first, arr.begin() + last, block);
+                SortingNetwork::sortBlock(block, n);
+                comparisons += SortingNetwork::comparators(n);
+                for (size_t i = 0; i < n; ++i) {
+                    co_yield write(first + i, block[i]);
+                }
+                co_return;
+            }
+        }
+        for (size_t i = first + 1; i < last; ++i) {
+            T value = arr[i];
+            size_t j = i;
+            while (j > first) {
+                co_yield compare(j - 1, j);
+                if (!before(value, arr[j - 1])) break;
+                co_yield write(j, arr[j - 1]);
+                --j;
+            }
+            if (j != i) co_yield write(j, value);
+        }
+    }
+
+    // Introsort in the style of pdqsort. Ranges are half-open [begin, end).
+    static constexpr size_t nintherThreshold = 128;
+    static constexpr size_t partitionBlock = 64;
+    static constexpr size_t partialInsertionLimit = 8;
+
+    SortTask sort2(size_t a, size_t b) {
+        co_yield compare(a, b);
+        if (before(arr[b], arr[a])) co_yield swapAt(a, b);
+    }
+
+    SortTask sort3(size_t a, size_t b, size_t c) {
+        co_yield sort2(a, b);
+        co_yield sort2(b, c);
+        co_yield sort2(a, b);
+    }
+
+    // The block partition classifies elements without branching and reports the comparisons
+    // afterwards: as steps when they are watched or recorded, otherwise only as a count.
+    SortTask reportCompares(size_t from, size_t count, bool backwards, size_t pivotIndex) {
+        if (!observed && !trace) {
+            comparisons += count;
+            co_return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            co_yield compare(backwards ? from - i : from + i, pivotIndex);
+        }
+    }
+
+    // Partitions around the pivot at arr[begin]: smaller values end up left of pivotIndex,
+    // the rest right of it. Elements are classified into blocks of offsets, then misplaced
+    // pairs are swapped. alreadyPartitioned is set when no swap was needed at all.
+    // Requires a value >= pivot somewhere after begin, which pivot selection guarantees.
+    SortTask partition(size_t begin, size_t end, size_t& pivotIndex, bool& alreadyPartitioned) {
+        const T pivotValue = arr[begin];
+        co_yield pivot(begin);
+        size_t first = begin, last = end;
+        do {
+            ++first;
+            co_yield compare(first, begin);
+        } while (before(arr[first], pivotValue));
+        if (first - 1 == begin) {
+            while (first < last) {
+                --last;
+                co_yield compare(last, begin);
+                if (before(arr[last], pivotValue)) break;
+            }
+        } else {
+            do {
+                --last;
+                co_yield compare(last, begin);
+            } while (!before(arr[last], pivotValue));
+        }
+        alreadyPartitioned = first >= last;
+        if (alreadyPartitioned) {
+            pivotIndex = first - 1;
+            if (pivotIndex != begin) co_yield swapAt(begin, pivotIndex);
+            co_return;
+        }
+        co_yield swapAt(first, last);
+        ++first;
+
+        unsigned char offsetsL[partitionBlock], offsetsR[partitionBlock];
+        size_t numL = 0, numR = 0, startL = 0, startR = 0;
+        while (last - first > 2 * partitionBlock) {
+            if (numL == 0) {
+                startL = 0;
+                for (size_t i = 0; i < partitionBlock; ++i) {
+                    offsetsL[numL] = static_cast<unsigned char>(i);
+                    numL += !before(arr[first + i], pivotValue);
+                }
+                co_yield reportCompares(first, partitionBlock, false, begin);
+            }
+            if (numR == 0) {
+                startR = 0;
+                for (size_t i = 0; i < partitionBlock; ++i) {
+                    offsetsR[numR] = static_cast<unsigned char>(i + 1);
+                    numR += before(arr[last - i - 1], pivotValue);
+                }
+                co_yield reportCompares(last - 1, partitionBlock, true, begin);
+            }
+            size_t num = std::min(numL, numR);
+            for (size_t k = 0; k < num; ++k) {
+                co_yield swapAt(first + offsetsL[startL + k], last - offsetsR[startR + k]);
+            }
+            numL -= num;
+            numR -= num;
+            startL += num;
+            startR += num;
+            if (numL == 0) first += partitionBlock;
+            if (numR == 0) last -= partitionBlock;
+        }
+
+        // Fewer than three blocks remain; classify what is left and finish the same way.
+        size_t unknown = (last - first) - ((numL || numR) ? partitionBlock : 0);
+        size_t sizeL, sizeR;
+        if (numR) {
+            sizeL = unknown;
+            sizeR = partitionBlock;
+        } else if (numL) {
+            sizeL = partitionBlock;
+            sizeR = unknown;
+        } else {
+            sizeL = unknown / 2;
+            sizeR = unknown - sizeL;
+        }
+        if (unknown && !numL) {
+            startL = 0;
+            for (size_t i = 0; i < sizeL; ++i) {
+                offsetsL[numL] = static_cast<unsigned char>(i);
+                numL += !before(arr[first + i], pivotValue);
+            }
+            co_yield reportCompares(first, sizeL, false, begin);
+        }
+        if (unknown && !numR) {
+            startR = 0;
+            for (size_t i = 0; i < sizeR; ++i) {
+                offsetsR[numR] = static_cast<unsigned char>(i + 1);
+                numR += before(arr[last - i - 1], pivotValue);
+            }
+            co_yield reportCompares(last - 1, sizeR, true, begin);
+        }
+        size_t num = std::min(numL, numR);
+        for (size_t k = 0; k < num; ++k) {
+            co_yield swapAt(first + offsetsL[startL + k], last - offsetsR[startR + k]);
+        }
+        numL -= num;
+        numR -= num;
+        startL += num;
+        startR += num;
+        if (numL == 0) first += sizeL;
+        if (numR == 0) last -= sizeR;
+
+        // Only one side can have misplaced elements left; move them to the boundary.
+        if (numL) {
+            while (numL--) {
+                co_yield swapAt(first + offsetsL[startL + numL], --last);
+            }
+            first = last;
+        }
+        if (numR) {
+            while (numR--) {
+                co_yield swapAt(last - offsetsR[startR + numR], first);
+                ++first;
+            }
+        }
+        pivotIndex = first - 1;
+        if (pivotIndex != begin) co_yield swapAt(begin, pivotIndex);
+    }
+
+    // Partition for runs of values equal to the pivot at arr[begin], used when the pivot
+    // equals the element just left of the range: everything <= pivot goes left and is done.
+    SortTask partitionEqual(size_t begin, size_t end, size_t& pivotIndex) {
+        const T pivotValue = arr[begin];
+        co_yield pivot(begin);
+        size_t first = begin, last = end;
+        do {
+            --last;
+            co_yield compare(begin, last);
+        } while (before(pivotValue, arr[last]));
+        if (last + 1 == end) {
+            while (first < last) {
+                ++first;
+                co_yield compare(begin, first);
+                if (before(pivotValue, arr[first])) break;
+            }
+        } else {
+            do {
+                ++first;
+                co_yield compare(begin, first);
+            } while (!before(pivotValue, arr[first]));
+        }
+        while (first < last) {
+            co_yield swapAt(first, last);
+            do {
+                --last;
+                co_yield compare(begin, last);
+            } while (before(pivotValue, arr[last]));
+            do {
+                ++first;
+                co_yield compare(begin, first);
+            } while (!before(pivotValue, arr[first]));
+        }
+        pivotIndex = last;
+        if (pivotIndex != begin) co_yield swapAt(begin, pivotIndex);
+    }
+
+    // Insertion sort that gives up once it has moved more than a few elements. Sets sorted
+    // if it finished, which makes already-sorted partitions cost a single pass.
+    SortTask partialInsertionSort(size_t begin, size_t end, bool& sorted) {
+        sorted = false;
+        size_t moved = 0;
+        for (size_t cur = begin + 1; cur < end; ++cur) {
+            co_yield compare(cur - 1, cur);
+            if (!before(arr[cur], arr[cur - 1])) continue;
+            T value = arr[cur];
+            size_t sift = cur;
+            do {
+                co_yield write(sift, arr[sift - 1]);
+                --sift;
+                if (sift == begin) break;
+                co_yield compare(sift - 1, sift);
+            } while (before(value, arr[sift - 1]));
+            co_yield write(sift, value);
+            moved += cur - sift;
+            if (moved > partialInsertionLimit) co_return;
+        }
+        sorted = true;
+    }
+
+    // Moves the median of three (the ninther above nintherThreshold) to arr[begin], with a
+    // value not smaller than it left somewhere after begin, as partition() requires.
+    SortTask choosePivot(size_t begin, size_t end) {
+        size_t size = end - begin, half = size / 2;
+        if (size > nintherThreshold) {
+            co_yield sort3(begin, begin + half, end - 1);
+            co_yield sort3(begin + 1, begin + half - 1, end - 2);
+            co_yield sort3(begin + 2, begin + half + 1, end - 3);
+            co_yield sort3(begin + half - 1, begin + half, begin + half + 1);
+            co_yield swapAt(begin, begin + half);
+        } else {
+            co_yield sort3(begin + half, begin, end - 1);
+        }
+    }
+
+    // One level of the introsort. Recurses into the smaller side and loops on the larger,
+    // so the nesting depth stays O(log n); badAllowed counts unbalanced partitions left
+    // before the range is handed to heap sort.
+    SortTask introSort(size_t begin, size_t end, int badAllowed, bool leftmost) {
+        while (true) {
+            size_t size = end - begin;
+            if (size <= SortingNetwork::maxBlock) {
+                co_yield networkSort(begin, end);
+                co_return;
+            }
+
+            co_yield choosePivot(begin, end);
+
+            // A pivot equal to the value before the range means the range starts with a run of
+            // values equal to it; put them all on the left and continue with the rest.
+            if (!leftmost) {
+                co_yield compare(begin - 1, begin);
+                if (!before(arr[begin - 1], arr[begin])) {
+                    size_t pivotIndex = begin;
+                    co_yield partitionEqual(begin, end, pivotIndex);
+                    begin = pivotIndex + 1;
+                    continue;
+                }
+            }
+
+            size_t pivotIndex = begin;
+            bool alreadyPartitioned = false;
+            co_yield partition(begin, end, pivotIndex, alreadyPartitioned);
+            size_t sizeL = pivotIndex - begin, sizeR = end - (pivotIndex + 1);
+
+            if (sizeL < size / 8 || sizeR < size / 8) {
+                if (--badAllowed == 0) {
+                    co_yield heapSortRange(begin, end);
+                    co_return;
+                }
+                // Break up patterns that produced the bad split.
+                if (sizeL >= SortingNetwork::maxBlock) {
+                    co_yield swapAt(begin, begin + sizeL / 4);
+                    co_yield swapAt(pivotIndex - 1, pivotIndex - sizeL / 4);
+                    if (sizeL > nintherThreshold) {
+                        co_yield swapAt(begin + 1, begin + (sizeL / 4 + 1));
+                        co_yield swapAt(begin + 2, begin + (sizeL / 4 + 2));
+                        co_yield swapAt(pivotIndex - 2, pivotIndex - (sizeL / 4 + 1));
+                        co_yield swapAt(pivotIndex - 3, pivotIndex - (sizeL / 4 + 2));
+                    }
+                }
+                if (sizeR >= SortingNetwork::maxBlock) {
+                    co_yield swapAt(pivotIndex + 1, pivotIndex + (1 + sizeR / 4));
+                    co_yield swapAt(end - 1, end - sizeR / 4);
+                    if (sizeR > nintherThreshold) {
+                        co_yield swapAt(pivotIndex + 2, pivotIndex + (2 + sizeR / 4));
+                        co_yield swapAt(pivotIndex + 3, pivotIndex + (3 + sizeR / 4));
+                        co_yield swapAt(end - 2, end - (1 + sizeR / 4));
+                        co_yield swapAt(end - 3, end - (2 + sizeR / 4));
+                    }
+                }
+            } else if (alreadyPartitioned) {
+                bool leftSorted = false, rightSorted = false;
+                co_yield partialInsertionSort(begin, pivotIndex, leftSorted);
+                if (leftSorted) {
+                    co_yield partialInsertionSort(pivotIndex + 1, end, rightSorted);
+                    if (rightSorted) co_return;
+                }
+            }
+
+            if (sizeL < sizeR) {
+                co_yield introSort(begin, pivotIndex, badAllowed, leftmost);
+                begin = pivotIndex + 1;
+                leftmost = false;
+            } else {
+                co_yield introSort(pivotIndex + 1, end, badAllowed, false);
+                end = pivotIndex;
+            }
+        }
+    }
+
+    SortTask startQuickSort() {
+        size_t n = arr.size();
+        if (n < 2) co_return;
+        int depth = 0;
+        while (n >>= 1) ++depth;
+        co_yield introSort(0, arr.size(), depth, true);
+    }
+
+    // Selection. Like introSort, but only the side holding position nth is partitioned further,
+    // until arr[nth] holds the value sorting would put there, with nothing greater before it
+    // and nothing smaller after it. Above floydRivestThreshold the pivot is found by first
+    // selecting nth within a sample range around it (Floyd-Rivest), which leaves the pivot
+    // close to the target so about n + min(k, n - k) comparisons suffice. Ranges that keep
+    // splitting badly are heap sorted.
+    static constexpr size_t floydRivestThreshold = 600;
+
+    SortTask selectNth(size_t begin, size_t end, size_t nth, int badAllowed, bool leftmost) {
+        while (end - begin > SortingNetwork::maxBlock) {
+            size_t size = end - begin;
+            bool sampled = false;
+            if (size > floydRivestThreshold) {
+                double n = double(size), i = double(nth - begin + 1);
+                double z = std::log(n), s = 0.5 * std::exp(2 * z / 3);
+                double sd = 0.5 * std::sqrt(z * s * (n - s) / n) * (i < n / 2 ? -1 : 1);
+                size_t lo = static_cast<size_t>(std::max(double(begin), double(nth) - i * s / n + sd));
+                size_t hi = static_cast<size_t>(std::min(double(end - 1), double(nth) + (n - i) * s / n + sd));
+                // The sample's neighbours aren't bounds for it, hence leftmost.
+                co_yield selectNth(lo, hi + 1, nth, badAllowed, true);
+                // Values after nth in the sample are not smaller than the pivot, as partition() needs.
+                if (hi > nth) {
+                    co_yield swapAt(begin, nth);
+                    sampled = true;
+                }
+            }
+            if (!sampled) co_yield choosePivot(begin, end);
+
+            if (!leftmost) {
+                co_yield compare(begin - 1, begin);
+                if (!before(arr[begin - 1], arr[begin])) {
+                    size_t pivotIndex = begin;
+                    co_yield partitionEqual(begin, end, pivotIndex);
+                    if (nth <= pivotIndex) co_return; // Inside the run of values equal to the pivot
+                    begin = pivotIndex + 1;
+                    continue;
+                }
+            }
+
+            size_t pivotIndex = begin;
+            bool alreadyPartitioned = false;
+            co_yield partition(begin, end, pivotIndex, alreadyPartitioned);
+            if (nth == pivotIndex) co_return;
+            size_t kept = nth < pivotIndex ? pivotIndex - begin : end - (pivotIndex + 1);
+            if (kept > size / 8 * 7 && --badAllowed == 0) {
+                co_yield heapSortRange(nth < pivotIndex ? begin : pivotIndex + 1, nth < pivotIndex ? pivotIndex : end);
+                co_return;
+            }
+            if (nth < pivotIndex) {
+                end = pivotIndex;
+            } else {
+                begin = pivotIndex + 1;
+                leftmost = false;
+            }
+        }
+        co_yield networkSort(begin, end);
+    }
+
+    // Size of the front the selection algorithms order: selectCount, or the lower median.
+    size_t selectionSize() const {
+        return selectCount && selectCount <= arr.size() ? selectCount : (arr.size() + 1) / 2;
+    }
+
+    int selectionDepth() const {
+        int depth = 0;
+        for (size_t n = arr.size(); n >>= 1;) ++depth;
+        return depth;
+    }
+
+    // The k-th smallest value at arr[k - 1], smaller-or-equal ones before it.
+    SortTask nthElement() {
+        size_t k = selectionSize();
+        if (k == 0) co_return;
+        co_yield selectNth(0, arr.size(), k - 1, selectionDepth(), true);
+    }
+
+    // The k smallest values in order at the front: selection, then introsort of the front.
+    SortTask partialSort() {
+        size_t k = selectionSize();
+        if (k == 0) co_return;
+        co_yield selectNth(0, arr.size(), k - 1, selectionDepth(), true);
+        if (k > 2) co_yield introSort(0, k - 1, selectionDepth(), true);
+    }
+
+    // Streaming top k: a heapArity-ary max heap of the k smallest values seen so far in
+    // arr[0, k), which each later value replaces the root of if it is smaller. Reads every
+    // value once in order, so it also suits inputs that arrive one at a time. The heap is
+    // sorted in place at the end.
+    SortTask topK() {
+        const size_t n = arr.size(), k = selectionSize();
+        if (k == 0) co_return;
+        for (size_t i = (k - 1) / heapArity + 1; i-- > 0;) {
+            co_yield siftDown(0, k, i);
+        }
+        for (size_t i = k; i < n; ++i) {
+            co_yield compare(i, 0);
+            if (before(arr[i], arr[0])) {
+                co_yield swapAt(0, i);
+                co_yield siftDown(0, k, 0);
+            }
+        }
+        for (size_t i = k; i-- > 1;) {
+            co_yield swapAt(0, i);
+            co_yield siftDown(0, i, 0);
+        }
+    }
+
+    SortTask merge(int left, int mid, int right) {
+        ScratchArena::Scope scope(scratch);
+        size_t length = right - left + 1;
+        T* temp = scratch.allocate<T>(length);
+        // Unwatched plain ints merge with the vector kernel; otherwise each compare is a step
+        // when watched or recorded, and only counted when not.
+        bool merged = false;
+        if constexpr (plainInts) {
+            if (!observed && !trace) {
+                comparisons += SortingNetwork::mergeRuns(&arr[left], mid - left + 1, &arr[mid + 1], right - mid, temp);
+                merged = true;
+            }
+        }
+        if (!merged) {
+            const bool stepped = observed || trace;
+            size_t i = left, j = mid + 1, k = 0;
+            const size_t leftEnd = mid + 1, rightEnd = right + 1;
+            while (i < leftEnd && j < rightEnd) {
+                if (stepped) {
+                    co_yield compare(i, j);
+                } else {
+                    ++comparisons;
+                }
+                temp[k++] = before(arr[j], arr[i]) ? arr[j++] : arr[i++];
+            }
+            while (i < leftEnd) temp[k++] = arr[i++];
+            while (j < rightEnd) temp[k++] = arr[j++];
+        }
+        if (cache) {
+            // The merge into temp reads both runs front to back while filling temp in order.
+            for (size_t idx = 0; idx < length; ++idx) {
+                touch(&arr[left + idx]);
+                touch(&temp[idx]);
+            }
+        }
+        for (size_t idx = 0; idx < length; ++idx) {
+            touch(&temp[idx]);
+            co_yield write(left + idx, temp[idx]);
+        }
+    }
+
+    SortTask mergeSort(int left, int right) {
+        if (left >= right) co_return;
+        if (right - left < static_cast<int>(SortingNetwork::maxBlock)) {
+            co_yield networkSort(left, right + 1);
+            co_return;
+        }
+        int mid = left + (right - left) / 2;
+        co_yield mergeSort(left, mid);
+        co_yield mergeSort(mid + 1, right);
+        co_yield merge(left, mid, right);
+    }
+
+    SortTask startMergeSort() {
+        scratch.reset(arr.size() * sizeof(T));
+        co_yield mergeSort(0, static_cast<int>(arr.size()) - 1);
+    }
+
+    // Floyd's bottom-up sift of node i in the heapArity-ary max heap at arr[base, base + n):
+    // follows the largest child down to a leaf (one comparison per sibling), climbs back to
+    // the first node not smaller than arr[i], then shifts that path up by one and puts the old
+    // arr[i] there. Costs about one comparison per level fewer than sifting down directly.
+    SortTask siftDown(size_t base, size_t n, size_t i) {
+        const size_t d = heapArity;
+        size_t node = i;
+        while (d * node + 1 < n) {
+            size_t child = d * node + 1, last = std::min(child + d, n), largest = child;
+            for (size_t c = child + 1; c < last; ++c) {
+                co_yield compare(base + c, base + largest);
+                if (before(arr[base + largest], arr[base + c])) largest = c;
+            }
+            node = largest;
+        }
+        const T value = arr[base + i];
+        while (node != i) {
+            co_yield compare(base + node, base + i);
+            if (!before(arr[base + node], value)) break;
+            node = (node - 1) / d;
+        }
+        if (node == i) co_return;
+        T carry = value;
+        do {
+            T displaced = arr[base + node];
+            co_yield write(base + node, carry);
+            carry = displaced;
+            node = (node - 1) / d;
+        } while (node != i);
+        co_yield write(base + i, carry);
+    }
+
+    // siftDown without steps, for unobserved runs. The first element of every grandchild
+    // group is prefetched while the children are compared, so the next level is usually in
+    // cache by the time the walk reaches it.
+    template <size_t D>
+    void siftQuietly(size_t base, size_t n, size_t i, unsigned long long& compares, unsigned long long& writes) {
+        T* heap = arr.data() + base;
+        size_t node = i;
+        while (D * node + 1 < n) {
+            size_t child = D * node + 1, last = std::min(child + D, n), largest = child;
+            for (size_t c = child; c < last && D * c + 1 < n; ++c) {
+                prefetchRead(heap + D * c + 1);
+            }
+            for (size_t c = child + 1; c < last; ++c) {
+                if (before(heap[largest], heap[c])) largest = c;
+            }
+            compares += last - child - 1;
+            node = largest;
+        }
+        const T value = heap[i];
+        while (node != i) {
+            ++compares;
+            if (!before(heap[node], value)) break;
+            node = (node - 1) / D;
+        }
+        if (node == i) return;
+        T carry = value;
+        do {
+            std::swap(carry, heap[node]);
+            ++writes;
+            node = (node - 1) / D;
+        } while (node != i);
+        heap[i] = carry;
+        ++writes;
+    }
+
+    template <size_t D>
+    void heapSortQuietly(size_t begin, size_t end) {
+        const size_t n = end - begin;
+        unsigned long long compares = 0, writes = 0;
+        for (size_t i = (n - 2) / D + 1; i-- > 0;) {
+            siftQuietly<D>(begin, n, i, compares, writes);
+        }
+        for (size_t i = n; i-- > 1;) {
+            std::swap(arr[begin], arr[begin + i]);
+            ++writes;
+            siftQuietly<D>(begin, i, 0, compares, writes);
+        }
+        comparisons += compares;
+        swaps += writes;
+    }
+
+    SortTask heapSortRange(size_t begin, size_t end) {
+        const size_t n = end - begin;
+        if (n < 2) co_return;
+        if (!observed && !trace) {
+            switch (heapArity) {
+                case 4: heapSortQuietly<4>(begin, end); break;
+                case 8: heapSortQuietly<8>(begin, end); break;
+                default: heapSortQuietly<2>(begin, end); break;
+            }
+            co_return;
+        }
+        for (size_t i = (n - 2) / heapArity + 1; i-- > 0;) {
+            co_yield siftDown(begin, n, i);
+        }
+        for (size_t i = n; i-- > 1;) {
+            co_yield swapAt(begin, begin + i);
+            co_yield siftDown(begin, i, 0);
+        }
+    }
+
+    SortTask startHeapSort() {
+        co_yield heapSortRange(0, arr.size());
+    }
+
+    // TimSort helpers. A run is a sorted slice [base, base + length) on the run stack.
+    struct TimRun {
+        size_t base;
+        size_t length;
+    };
+    static constexpr size_t minGallopStart = 7;
+    static constexpr size_t maxTimRuns = 85; // Enough for 2^64 elements given the stack invariants
+
+    // Returns the minimum run length: n shifted into [32, 64], rounded up if any bit was
+    // shifted out, so n / minrun is a power of two or just below one.
+    static size_t minRunLength(size_t n) {
+        size_t carry = 0;
+        while (n >= SortingNetwork::maxBlock) {
+            carry |= n & 1;
+            n >>= 1;
+        }
+        return n + carry;
+    }
+
+    // Finds the run starting at lo. Strictly descending runs are reversed in place, so the
+    // sort stays stable.
+    SortTask countRun(size_t lo, size_t& runEnd) {
+        size_t hi = lo + 1;
+        if (hi == arr.size()) {
+            runEnd = hi;
+            co_return;
+        }
+        co_yield compare(lo, hi);
+        if (before(arr[hi], arr[lo])) {
+            for (++hi; hi < arr.size(); ++hi) {
+                co_yield compare(hi - 1, hi);
+                if (!before(arr[hi], arr[hi - 1])) break;
+            }
+            for (size_t i = lo, j = hi - 1; i < j; ++i, --j) {
+                co_yield swapAt(i, j);
+            }
+        } else {
+            for (++hi; hi < arr.size(); ++hi) {
+                co_yield compare(hi - 1, hi);
+                if (before(arr[hi], arr[hi - 1])) break;
+            }
+        }
+        runEnd = hi;
+    }
+
+    // Finds where key goes in the sorted run[0, length), searching outwards from hint in
+    // steps of 1, 3, 7, ... and then binary searching the last gap. With `right` set, key
+    // goes after equal elements, otherwise before them. `run` may point into arr or into a
+    // merge buffer, so compare steps use keyIndex and visualBase + offset as stand-ins.
+    SortTask gallop(T key, size_t keyIndex, const T* run, size_t visualBase, size_t length, size_t hint, bool right, size_t& result) {
+        auto after = [&](size_t i) { return right ? !before(key, run[i]) : before(run[i], key); };
+        size_t lastOfs = 0, ofs = 1;
+        co_yield compare(keyIndex, visualBase + hint);
+        if (after(hint)) {
+            size_t maxOfs = length - hint;
+            while (ofs < maxOfs) {
+                co_yield compare(keyIndex, visualBase + hint + ofs);
+                if (!after(hint + ofs)) break;
+                lastOfs = ofs;
+                ofs = (ofs << 1) + 1;
+            }
+            ofs = std::min(ofs, maxOfs);
+            lastOfs += hint + 1;
+            ofs += hint;
+        } else {
+            size_t maxOfs = hint + 1;
+            while (ofs < maxOfs) {
+                co_yield compare(keyIndex, visualBase + hint - ofs);
+                if (after(hint - ofs)) break;
+                lastOfs = ofs;
+                ofs = (ofs << 1) + 1;
+            }
+            ofs = std::min(ofs, maxOfs);
+            size_t below = hint + 1 - ofs; // One past the last index known to go before key
+            ofs = hint - lastOfs;
+            lastOfs = below;
+        }
+        while (lastOfs < ofs) {
+            size_t mid = lastOfs + (ofs - lastOfs) / 2;
+            co_yield compare(keyIndex, visualBase + mid);
+            if (after(mid)) {
+                lastOfs = mid + 1;
+            } else {
+                ofs = mid;
+            }
+        }
+        result = ofs;
+    }
+
+    // Merges adjacent runs with len1 <= len2, buffering the first. Buffered values are shown
+    // at the positions they will occupy if nothing from the second run overtakes them.
+    SortTask mergeLo(size_t base1, size_t len1, size_t base2, size_t len2, size_t& minGallop) {
+        ScratchArena::Scope scope(scratch);
+        T* tmp = scratch.allocate<T>(len1);
+        std::copy(arr.begin() + base1, arr.begin() + base1 + len1, tmp);
+        if (cache) {
+            for (size_t k = 0; k < len1; ++k) {
+                touch(&arr[base1 + k]);
+                touch(&tmp[k]);
+            }
+        }
+        size_t cursor1 = 0, cursor2 = base2, dest = base1;
+        co_yield write(dest++, arr[cursor2++]);
+        bool done = --len2 == 0 || len1 == 1;
+        while (!done) {
+            size_t count1 = 0, count2 = 0;
+            while (!done && (count1 | count2) < minGallop) {
+                co_yield compare(dest, cursor2);
+                if (before(arr[cursor2], tmp[cursor1])) {
+                    co_yield write(dest++, arr[cursor2++]);
+                    ++count2;
+                    count1 = 0;
+                    done = --len2 == 0;
+                } else {
+                    co_yield write(dest++, tmp[cursor1++]);
+                    ++count1;
+                    count2 = 0;
+                    done = --len1 == 1;
+                }
+            }
+            while (!done) {
+                co_yield gallop(arr[cursor2], cursor2, tmp + cursor1, dest, len1, 0, true, count1);
+                for (size_t k = 0; k < count1; ++k) {
+                    co_yield write(dest++, tmp[cursor1++]);
+                }
+                len1 -= count1;
+                if ((done = len1 <= 1)) break;
+                co_yield write(dest++, arr[cursor2++]);
+                if ((done = --len2 == 0)) break;
+                co_yield gallop(tmp[cursor1], dest, arr.data() + cursor2, cursor2, len2, 0, false, count2);
+                for (size_t k = 0; k < count2; ++k) {
+                    co_yield write(dest++, arr[cursor2++]);
+                }
+                len2 -= count2;
+                if ((done = len2 == 0)) break;
+                co_yield write(dest++, tmp[cursor1++]);
+                if ((done = --len1 == 1)) break;
+                if (minGallop > 0) --minGallop;
+                if (count1 < minGallopStart && count2 < minGallopStart) break;
+            }
+            if (!done) minGallop += 2; // Penalize leaving gallop mode
+        }
+        minGallop = std::max<size_t>(minGallop, 1);
+        if (len1 == 1) {
+            // The buffered value is greater than everything left in the second run.
+            for (size_t k = 0; k < len2; ++k) {
+                co_yield write(dest++, arr[cursor2++]);
+            }
+            co_yield write(dest, tmp[cursor1]);
+        } else {
+            for (size_t k = 0; k < len1; ++k) {
+                co_yield write(dest++, tmp[cursor1++]);
+            }
+        }
+    }
+
+    // Mirror of mergeLo for len1 > len2: buffers the second run and merges from the right.
+    // Cursors point one past the next value to take.
+    SortTask mergeHi(size_t base1, size_t len1, size_t base2, size_t len2, size_t& minGallop) {
+        ScratchArena::Scope scope(scratch);
+        T* tmp = scratch.allocate<T>(len2);
+        std::copy(arr.begin() + base2, arr.begin() + base2 + len2, tmp);
+        if (cache) {
+            for (size_t k = 0; k < len2; ++k) {
+                touch(&arr[base2 + k]);
+                touch(&tmp[k]);
+            }
+        }
+        size_t cursor1 = base1 + len1, cursor2 = len2, dest = base2 + len2;
+        co_yield write(--dest, arr[--cursor1]);
+        bool done = --len1 == 0 || len2 == 1;
+        while (!done) {
+            size_t count1 = 0, count2 = 0;
+            while (!done && (count1 | count2) < minGallop) {
+                co_yield compare(cursor1 - 1, dest - 1);
+                if (before(tmp[cursor2 - 1], arr[cursor1 - 1])) {
+                    co_yield write(--dest, arr[--cursor1]);
+                    ++count1;
+                    count2 = 0;
+                    done = --len1 == 0;
+                } else {
+                    co_yield write(--dest, tmp[--cursor2]);
+                    ++count2;
+                    count1 = 0;
+                    done = --len2 == 1;
+                }
+            }
+            while (!done) {
+                size_t position = 0;
+                co_yield gallop(tmp[cursor2 - 1], dest - 1, arr.data() + base1, base1, len1, len1 - 1, true, position);
+                count1 = len1 - position;
+                for (size_t k = 0; k < count1; ++k) {
+                    co_yield write(--dest, arr[--cursor1]);
+                }
+                len1 -= count1;
+                if ((done = len1 == 0)) break;
+                co_yield write(--dest, tmp[--cursor2]);
+                if ((done = --len2 == 1)) break;
+                co_yield gallop(arr[cursor1 - 1], cursor1 - 1, tmp, dest - cursor2, len2, len2 - 1, false, position);
+                count2 = len2 - position;
+                for (size_t k = 0; k < count2; ++k) {
+                    co_yield write(--dest, tmp[--cursor2]);
+                }
+                len2 -= count2;
+                if ((done = len2 <= 1)) break;
+                co_yield write(--dest, arr[--cursor1]);
+                if ((done = --len1 == 0)) break;
+                if (minGallop > 0) --minGallop;
+                if (count1 < minGallopStart && count2 < minGallopStart) break;
+            }
+            if (!done) minGallop += 2;
+        }
+        minGallop = std::max<size_t>(minGallop, 1);
+        if (len2 == 1) {
+            // The buffered value is smaller than everything left in the first run.
+            for (size_t k = 0; k < len1; ++k) {
+                co_yield write(--dest, arr[--cursor1]);
+            }
+            co_yield write(--dest, tmp[--cursor2]);
+        } else {
+            for (size_t k = 0; k < len2; ++k) {
+                co_yield write(--dest, tmp[--cursor2]);
+            }
+        }
+    }
+
+    // Merges runs[i] and runs[i + 1]. Values of the first run that are already in place
+    // (before the second run's head) and of the second run after the first run's tail are
+    // trimmed by galloping before anything is buffered.
+    SortTask mergeRunsAt(TimRun* runs, size_t& runCount, size_t i, size_t& minGallop) {
+        size_t base1 = runs[i].base, len1 = runs[i].length;
+        size_t base2 = runs[i + 1].base, len2 = runs[i + 1].length;
+        runs[i].length = len1 + len2;
+        if (i + 3 == runCount) runs[i + 1] = runs[i + 2];
+        --runCount;
+
+        size_t skip = 0;
+        co_yield gallop(arr[base2], base2, arr.data() + base1, base1, len1, 0, true, skip);
+        base1 += skip;
+        len1 -= skip;
+        if (len1 > 0) {
+            co_yield gallop(arr[base1 + len1 - 1], base1 + len1 - 1, arr.data() + base2, base2, len2, len2 - 1, false, len2);
+            if (len2 > 0) {
+                if (len1 <= len2) {
+                    co_yield mergeLo(base1, len1, base2, len2, minGallop);
+                } else {
+                    co_yield mergeHi(base1, len1, base2, len2, minGallop);
+                }
+            }
+        }
+        co_yield runSpan(runs[i].base, runs[i].base + runs[i].length - 1);
+    }
+
+    // Detects natural runs (extending short ones to minrun with the sorting network), keeps
+    // the run stack lengths decreasing faster than Fibonacci by merging on push, and
+    // gallops once one side keeps winning.
+    SortTask timSort() {
+        const size_t n = arr.size();
+        if (n < 2) co_return;
+        scratch.reset(maxTimRuns * sizeof(TimRun) + (n / 2 + 1) * sizeof(T) + alignof(T));
+        TimRun* runs = scratch.allocate<TimRun>(maxTimRuns);
+        size_t runCount = 0;
+        size_t minGallop = minGallopStart;
+        const size_t minRun = minRunLength(n);
+        for (size_t lo = 0; lo < n;) {
+            size_t runEnd = lo;
+            co_yield countRun(lo, runEnd);
+            if (runEnd - lo < minRun) {
+                runEnd = std::min(lo + minRun, n);
+                co_yield networkSort(lo, runEnd);
+            }
+            co_yield runSpan(lo, runEnd - 1);
+            runs[runCount++] = {lo, runEnd - lo};
+            lo = runEnd;
+
+            while (runCount > 1) {
+                size_t i = runCount - 2;
+                bool brokenAbove = (i > 0 && runs[i - 1].length <= runs[i].length + runs[i + 1].length) ||
+                                   (i > 1 && runs[i - 2].length <= runs[i - 1].length + runs[i].length);
+                if (brokenAbove) {
+                    if (runs[i - 1].length < runs[i + 1].length) --i;
+                } else if (runs[i].length > runs[i + 1].length) {
+                    break;
+                }
+                co_yield mergeRunsAt(runs, runCount, i, minGallop);
+            }
+        }
+        while (runCount > 1) {
+            size_t i = runCount - 2;
+            if (i > 0 && runs[i - 1].length < runs[i + 1].length) --i;
+            co_yield mergeRunsAt(runs, runCount, i, minGallop);
+        }
+    }
+
+    // Bitonic network over the whole array, with positions past the end treated as +infinity.
+    // The first step of each stage compares mirrored pairs so every comparator sorts upwards
+    // and comparators touching the padding can simply be skipped.
+    SortTask bitonicSort() {
+        size_t n = arr.size(), padded = 1;
+        while (padded < n) padded <<= 1;
+        for (size_t k = 2; k <= padded; k <<= 1) {
+            for (size_t j = k >> 1; j > 0; j >>= 1) {
+                for (size_t i = 0; i < padded; ++i) {
+                    if (i & j) continue;
+                    size_t l = j == k >> 1 ? (i | (k - 1)) - (i & (k - 1)) : i + j;
+                    if (l >= n) continue;
+                    co_yield compare(i, l);
+                    if (before(arr[l], arr[i])) {
+                        co_yield swapAt(i, l);
+                    }
+                }
+            }
+        }
+    }
+
+    static constexpr size_t countingRangePerKey = 4; // Wider key ranges are handed to radix sort...
+    static constexpr size_t countingMinRange = 1 << 16; // ...unless they are this narrow anyway
+    static constexpr size_t countingStripe = 1 << 16; // Fewest keys worth a histogram of their own
+
+    // Unobserved counting sort on the pool. Every stripe of arr counts into its own histogram,
+    // a key-major prefix sum over the histograms gives each stripe its slots for every key, and
+    // the stripes scatter into a buffer in parallel, so equal keys keep their order. Bare
+    // integers skip the scatter and are rebuilt from the totals, one slice of arr per task.
+    // There are at most n / range stripes, so the histograms never outgrow the input.
+    template <class SlotOf, class ValueOf>
+    void countInParallel(const SlotOf& slotOf, const ValueOf& valueOf, size_t range) {
+        constexpr bool rebuild = std::is_same_v<KeyOf, IdentityKey<T>>;
+        ThreadPool& workers = threadPool();
+        const size_t n = arr.size();
+        const size_t stripes = std::clamp<size_t>(std::min(n / countingStripe, n / range), 1, workers.size());
+        const size_t stride = (range + 7) & ~size_t(7); // Histograms of different stripes on separate cache lines
+        auto stripeBegin = [&](size_t s) { return n * s / stripes; };
+        auto inParallel = [&](auto&& task) {
+            TaskGroup group(workers);
+            for (size_t s = 1; s < stripes; ++s) {
+                group.run([&task, s] { task(s); });
+            }
+            task(0);
+            group.wait();
+        };
+        scratch.reset(stripes * stride * sizeof(size_t) + (rebuild ? 0 : n * sizeof(T) + alignof(T)));
+        size_t* counts = scratch.allocate<size_t>(stripes * stride);
+        inParallel([&](size_t s) {
+            size_t* local = counts + s * stride;
+            std::fill(local, local + range, 0);
+            for (size_t i = stripeBegin(s); i < stripeBegin(s + 1); ++i) {
+                ++local[slotOf(arr[i])];
+            }
+        });
+        size_t sum = 0;
+        for (size_t slot = 0; slot < range; ++slot) {
+            for (size_t s = 0; s < stripes; ++s) {
+                size_t count = counts[s * stride + slot];
+                counts[s * stride + slot] = sum;
+                sum += count;
+            }
+        }
+
+        if constexpr (rebuild) {
+            // The first histogram now holds where each key starts in the output.
+            inParallel([&](size_t s) {
+                size_t i = stripeBegin(s), to = stripeBegin(s + 1);
+                size_t slot = std::upper_bound(counts, counts + range, i) - counts - 1;
+                for (; i < to; ++slot) {
+                    size_t end = std::min(slot + 1 < range ? counts[slot + 1] : n, to);
+                    std::fill(arr.begin() + i, arr.begin() + end, valueOf(slot));
+                    i = end;
+                }
+            });
+        } else {
+            T* output = scratch.allocate<T>(n);
+            inParallel([&](size_t s) {
+                size_t* next = counts + s * stride;
+                for (size_t i = stripeBegin(s); i < stripeBegin(s + 1); ++i) {
+                    output[next[slotOf(arr[i])]++] = arr[i];
+                }
+            });
+            inParallel([&](size_t s) { std::copy(output + stripeBegin(s), output + stripeBegin(s + 1), arr.begin() + stripeBegin(s)); });
+        }
+    }
+
+    // Needs integer keys; other key types are handed to radix sort, and so are key ranges
+    // wider than max(4n, 64K), whose counters would cost more than radix sort's passes.
+    // Counters are offset by the smallest key. Bare integers are rebuilt from the counts,
+    // anything else is scattered stably by key. Unobserved sorts count on the pool.
+    SortTask countingSort() {
+        if constexpr (!naturalOrder || !std::is_integral_v<Key>) {
+            co_yield radixSort();
+        } else {
+            using Offset = std::make_unsigned_t<Key>; // Differences of keys wrap instead of overflowing
+            if (arr.empty()) co_return;
+            const size_t n = arr.size();
+            auto [minIt, maxIt] = std::minmax_element(arr.begin(), arr.end(), Before{keyOf, less});
+            const Offset minKey = static_cast<Offset>(keyOf(*minIt));
+            const uint64_t span = static_cast<Offset>(static_cast<Offset>(keyOf(*maxIt)) - minKey);
+            if (span >= std::max<uint64_t>(countingRangePerKey * n, countingMinRange)) {
+                co_yield radixSort();
+                co_return;
+            }
+            const size_t range = static_cast<size_t>(span) + 1;
+            auto slotOf = [&](const T& value) { return static_cast<size_t>(static_cast<Offset>(static_cast<Offset>(keyOf(value)) - minKey)); };
+            auto valueOf = [&](size_t slot) { return static_cast<Key>(static_cast<Offset>(minKey + slot)); };
+            if (!observed && !trace) {
+                countInParallel(slotOf, valueOf, range);
+                swaps += n;
+                co_return;
+            }
+            if constexpr (std::is_same_v<KeyOf, IdentityKey<T>>) {
+                scratch.reset(range * sizeof(size_t));
+                size_t* count = scratch.allocate<size_t>(range);
+                std::fill(count, count + range, 0);
+                for (size_t i = 0; i < n; ++i) {
+                    ++count[slotOf(arr[i])];
+                    touch(&count[slotOf(arr[i])]);
+                    co_yield read(i);
+                }
+                size_t k = 0;
+                for (size_t slot = 0; slot < range; ++slot) {
+                    touch(&count[slot]);
+                    while (count[slot] > 0) {
+                        co_yield write(k, valueOf(slot));
+                        --count[slot];
+                        ++k;
+                    }
+                }
+            } else {
+                scratch.reset((range + 1) * sizeof(size_t) + n * sizeof(T) + alignof(T));
+                size_t* starts = scratch.allocate<size_t>(range + 1);
+                T* output = scratch.allocate<T>(n);
+                std::fill(starts, starts + range + 1, 0);
+                for (size_t i = 0; i < n; ++i) {
+                    ++starts[slotOf(arr[i]) + 1];
+                    touch(&starts[slotOf(arr[i]) + 1]);
+                    co_yield read(i);
+                }
+                for (size_t slot = 0; slot < range; ++slot) {
+                    starts[slot + 1] += starts[slot];
+                    touch(&starts[slot + 1]);
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    size_t& start = starts[slotOf(arr[i])];
+                    touch(&arr[i]);
+                    touch(&start);
+                    touch(&output[start]);
+                    output[start++] = arr[i];
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    touch(&output[i]);
+                    co_yield write(i, output[i]);
+                }
+            }
+        }
+    }
+
+    // LSD radix sort on the key bits from RadixKey, so negative and floating-point keys order
+    // correctly. All digit histograms come from one pass, digits where every key lands in
+    // the same bucket are skipped, and each pass scatters between arr and one buffer.
+    // Scatters into arr show up as writes; scatters into the buffer as reads of arr.
+    // Custom orderings have no digits and fall back to introsort.
+    SortTask radixSort() {
+        if constexpr (!naturalOrder) {
+            co_yield startQuickSort();
+        } else {
+            using Bits = typename RadixKey<Key>::Bits;
+            const size_t n = arr.size();
+            if (n < 2) co_return;
+            const unsigned bits = radixBits;
+            const unsigned passes = (sizeof(Key) * 8 + bits - 1) / bits;
+            const size_t buckets = size_t(1) << bits;
+            const Bits mask = static_cast<Bits>(buckets - 1);
+            auto digits = [this](const T& value) { return RadixKey<Key>::encode(keyOf(value)); };
+
+            scratch.reset(passes * buckets * sizeof(size_t) + n * sizeof(T) + alignof(T));
+            size_t* counts = scratch.allocate<size_t>(passes * buckets);
+            T* buffer = scratch.allocate<T>(n);
+            std::fill(counts, counts + passes * buckets, 0);
+            for (size_t i = 0; i < n; ++i) {
+                Bits k = digits(arr[i]);
+                for (unsigned d = 0; d < passes; ++d) {
+                    ++counts[d * buckets + ((k >> (d * bits)) & mask)];
+                    touch(&counts[d * buckets + ((k >> (d * bits)) & mask)]);
+                }
+                co_yield read(i);
+            }
+
+            bool inArr = true; // Where the current order lives
+            for (unsigned d = 0; d < passes; ++d) {
+                size_t* offsets = &counts[d * buckets];
+                const T& first = inArr ? arr[0] : buffer[0];
+                if (offsets[(digits(first) >> (d * bits)) & mask] == n) continue;
+                size_t sum = 0;
+                for (size_t b = 0; b < buckets; ++b) {
+                    size_t count = offsets[b];
+                    offsets[b] = sum;
+                    sum += count;
+                }
+                if (inArr) {
+                    for (size_t i = 0; i < n; ++i) {
+                        size_t& offset = offsets[(digits(arr[i]) >> (d * bits)) & mask];
+                        touch(&offset);
+                        touch(&buffer[offset]);
+                        buffer[offset++] = arr[i];
+                        co_yield read(i);
+                    }
+                } else {
+                    for (size_t i = 0; i < n; ++i) {
+                        size_t& offset = offsets[(digits(buffer[i]) >> (d * bits)) & mask];
+                        touch(&buffer[i]);
+                        touch(&offset);
+                        co_yield write(offset++, buffer[i]);
+                    }
+                }
+                inArr = !inArr;
+            }
+            if (!inArr) {
+                for (size_t i = 0; i < n; ++i) {
+                    touch(&buffer[i]);
+                    co_yield write(i, buffer[i]);
+                }
+            }
+        }
+    }
+
+    // Buckets are laid out flat: one counting pass, a prefix sum for the bucket starts and a
+    // scatter into a single buffer, after which each bucket is a contiguous range. Bucket
+    // positions interpolate the key linearly between the minimum and maximum.
+    SortTask bucketSort() {
+        if constexpr (!naturalOrder) {
+            co_yield startQuickSort();
+        } else {
+            if (arr.empty()) co_return;
+            Before order{keyOf, less};
+            auto [minIt, maxIt] = std::minmax_element(arr.begin(), arr.end(), order);
+            const double minKey = static_cast<double>(keyOf(*minIt));
+            const double span = static_cast<double>(keyOf(*maxIt)) - minKey;
+            if (!(span > 0)) co_return;
+            size_t n = arr.size();
+            size_t bucketCount = n / 10 + 1;
+            auto bucketOf = [&](const T& value) {
+                double position = (static_cast<double>(keyOf(value)) - minKey) / span * bucketCount;
+                return std::min(static_cast<size_t>(position), bucketCount - 1);
+            };
+
+            scratch.reset((bucketCount + 1) * sizeof(size_t) + n * sizeof(T) + alignof(T));
+            size_t* starts = scratch.allocate<size_t>(bucketCount + 1);
+            T* output = scratch.allocate<T>(n);
+            std::fill(starts, starts + bucketCount + 1, 0);
+            for (size_t i = 0; i < n; ++i) {
+                ++starts[bucketOf(arr[i]) + 1];
+                touch(&starts[bucketOf(arr[i]) + 1]);
+                co_yield read(i);
+            }
+            for (size_t b = 0; b < bucketCount; ++b) {
+                starts[b + 1] += starts[b];
+            }
+            // Scattering advances each start to the end of its bucket, i.e. the next bucket's start.
+            for (size_t i = 0; i < n; ++i) {
+                size_t& start = starts[bucketOf(arr[i])];
+                touch(&arr[i]);
+                touch(&start);
+                touch(&output[start]);
+                output[start++] = arr[i];
+            }
+            size_t k = 0;
+            for (size_t b = 0; b < bucketCount; ++b) {
+                std::sort(output + k, output + starts[b], order);
+                for (; k < starts[b]; ++k) {
+                    touch(&output[k]);
+                    co_yield write(k, output[k]);
+                }
+            }
+        }
+    }
+
+    // Runs ParallelSorter on the pool. Unobserved, it sorts arr in place with only counting.
+    // Otherwise the workers sort a private copy and stream their steps back, and arr follows
+    // by replaying them in order; this is valid because concurrent tasks only ever write
+    // disjoint ranges, and fork/join orders the rest.
+    enum class ParallelAlgorithm { Merge, Quick, Sample };
+
+    template <class Sorter>
+    static void runSorter(Sorter& sorter, ParallelAlgorithm algorithm) {
+        switch (algorithm) {
+            case ParallelAlgorithm::Merge: sorter.mergeSort(); break;
+            case ParallelAlgorithm::Quick: sorter.quickSort(); break;
+            case ParallelAlgorithm::Sample: sorter.sampleSort(); break;
+        }
+    }
+
+    SortTask runParallel(ParallelAlgorithm algorithm) {
+        ThreadPool& workers = threadPool();
+        if (!plainInts || (!observed && !trace)) {
+            CountingSink sink(workers);
+            scratch.reset(arr.size() * sizeof(T));
+            T* tmp = scratch.allocate<T>(arr.size());
+            ParallelSorter<CountingSink, T, Before> sorter(workers, arr.data(), tmp, arr.size(), sink, Before{keyOf, less});
+            runSorter(sorter, algorithm);
+            comparisons += sink.comparisons();
+            swaps += sink.swaps();
+            co_return;
+        }
+
+        // Only the int engine streams steps into the visualizer and traces.
+        if constexpr (plainInts) {
+            struct Run {
+                std::vector<int> data;
+                std::vector<int> tmp;
+                StepQueue queue;
+                std::exception_ptr error; // Set by the sorting task before it finishes the queue
+                bool started = false;
+                ~Run() {
+                    if (started) {
+                        queue.cancel();
+                        queue.waitFinished();
+                    }
+                }
+            };
+            auto run = std::make_unique<Run>();
+            run->data = arr;
+            run->tmp.resize(arr.size());
+            Run* state = run.get();
+            workers.submit([state, &workers, algorithm] {
+                try {
+                    StreamSink sink(workers, state->queue);
+                    ParallelSorter<StreamSink> sorter(workers, state->data.data(), state->tmp.data(), state->data.size(), sink);
+                    runSorter(sorter, algorithm);
+                } catch (...) {
+                    state->error = std::current_exception();
+                }
+                state->queue.finish();
+            });
+            run->started = true;
+
+            RemoteStep op;
+            while (run->queue.pop(op)) {
+                switch (op.type) {
+                    case StepType::Compare: co_yield compare(op.first, op.second, op.worker); break;
+                    case StepType::Swap: co_yield swapAt(op.first, op.second, op.worker); break;
+                    case StepType::Write: co_yield write(op.first, op.value, op.worker); break;
+                    default: break;
+                }
+            }
+            // The queue ends early when the sort failed; don't pass the partial result off as done.
+            if (run->error) std::rethrow_exception(run->error);
+        }
+    }
+
+    SortTask parallelMergeSort() { co_yield runParallel(ParallelAlgorithm::Merge); }
+    SortTask parallelQuickSort() { co_yield runParallel(ParallelAlgorithm::Quick); }
+    SortTask parallelSampleSort() { co_yield runParallel(ParallelAlgorithm::Sample); }
+};
+
+// The engine behind the visualizer and traces.
+using SortEngine = BasicSortEngine<int>;
+
+// What an algorithm leaves in arr: all of it sorted, or only the k smallest values at the
+// front (k from BasicSortEngine::selectCount), either sorted or with just the k-th in place.
+enum class SortOutput { Sorted, SortedPrefix, Nth };
+
+struct AlgorithmInfo {
+    const char* id; // Name used on the command line
+    const char* name;
+    const char* details;
+    bool quadratic;
+    bool parallel;
+    bool automatic = false; // Picks one of the others from the input, see chooseAlgorithm
+    SortOutput output = SortOutput::Sorted;
+};
+
+const std::vector<AlgorithmInfo> algorithms = {
+    {"bubble", "Bubble Sort", "Time: O(n^2)\nSpace: O(1)\nCompares adjacent elements, swaps if out of order.", true, false},
+    {"selection", "Selection Sort", "Time: O(n^2)\nSpace: O(1)\nFinds minimum in unsorted portion, places at start.", true, false},
+    {"insertion", "Insertion Sort", "Time: O(n^2)\nSpace: O(1)\nInserts each element into sorted portion.", true, false},
+    {"quick", "Quick Sort", "Time: O(n log n), O(n) on sorted input\nSpace: O(log n)\nPattern-defeating introsort: ninther pivots, block partitioning, heap sort after too many bad splits. Ranges of up to 64 go to a sorting network.", false, false},
+    {"merge", "Merge Sort", "Time: O(n log n)\nSpace: O(n)\nDivides and merges sorted halves; blocks of up to 64 are sorted by a network and merges run on vectors.", false, false},
+    {"heap", "Heap Sort", "Time: O(n log n)\nSpace: O(1)\nUses a max heap to sort elements. Each sift follows the larger children down to a leaf, then climbs back to where the sifted value belongs (Floyd), saving about one comparison per level.", false, false},
+    {"tim", "Tim Sort", "Time: O(n log n), O(n) on sorted input\nSpace: O(n)\nFinds natural runs (reversing descending ones), extends short ones to minrun with a sorting network and merges them with galloping. Each run gets its own tint.", false, false},
+    {"counting", "Counting Sort", "Time: O(n + k)\nSpace: O(k)\nCounts occurrences of each integer key between the smallest and largest, then rebuilds the array from the counts. Ranges much wider than n go to radix sort. Unobserved runs count stripes in parallel and scatter them stably.", false, true},
+    {"radix", "Radix Sort", "Time: O(n * 32/b)\nSpace: O(n + 2^b)\nLSD radix sort on b-bit digits (b = 8 by default) with ping-pong buffers. Digits shared by every key are skipped.", false, false},
+    {"bucket", "Bucket Sort", "Time: O(n + k)\nSpace: O(n + k)\nDistributes into buckets and sorts.", false, false},
+    {"pmerge", "Parallel Merge Sort", "Time: O(n log n / p)\nSpace: O(n)\nSorts halves on a work-stealing pool and merges slices cut along the merge path in parallel. Bars are tinted by the worker that last wrote them.", false, true},
+    {"pquick", "Parallel Quick Sort", "Time: O(n log n / p) avg\nSpace: O(log n)\nMedian-of-3 Hoare partitions; above the grain size the smaller side becomes a task on the work-stealing pool. Bars are tinted by the worker that last wrote them.", false, true},
+    {"bitonic", "Bitonic Sort", "Time: O(n log^2 n)\nSpace: O(1)\nA fixed network of compare-exchanges. Each stage is a pass of independent comparators, the same ones the SIMD kernels run side by side.", false, false},
+    {"psample", "Parallel Sample Sort", "Time: O(n log n / p)\nSpace: O(n)\nOversampled splitters cut the keys into buckets (keys equal to a splitter get their own). Threads classify stripes into local histograms, scatter in parallel and sort the buckets on the workers that first touched them. Bars are tinted by worker.", false, true},
+    {"select", "Quickselect", "Time: O(n) expected\nSpace: O(log n)\nPartitions like Quick Sort but only continues on the side holding the k-th smallest value, which ends up in its sorted place. Large ranges take their pivot from a sample around position k (Floyd-Rivest).", false, false, false, SortOutput::Nth},
+    {"topk", "Heap Top-k", "Time: O(n log k)\nSpace: O(1)\nKeeps the k smallest values seen so far in a max heap at the front; each later value replaces the root if it is smaller. The heap is sorted at the end.", false, false, false, SortOutput::SortedPrefix},
+    {"partial", "Partial Sort", "Time: O(n + k log k)\nSpace: O(log n)\nQuickselect for the k-th smallest value, then Quick Sort of everything before it.", false, false, false, SortOutput::SortedPrefix},
+    {"auto", "Auto", "Samples the input and runs the algorithm that was fastest on the most similar benchmarked input.", false, false, true},
+};
+
+// The table entry with the given command-line id, or nullptr.
+const AlgorithmInfo* findAlgorithm(const std::string& id) {
+    auto it = std::find_if(algorithms.begin(), algorithms.end(), [&](const AlgorithmInfo& info) { return id == info.id; });
+    return it == algorithms.end() ? nullptr : &*it;
+}
+
+// Entry points of the algorithms above, in the same order, for any engine instantiation.
+template <class Engine>
+using AlgorithmRunner = SortTask (Engine::*)();
+
+template <class Engine>
+constexpr AlgorithmRunner<Engine> algorithmRunners[] = {
+    &Engine::bubbleSort,
+    &Engine::selectionSort,
+    &Engine::insertionSort,
+    &Engine::startQuickSort,
+    &Engine::startMergeSort,
+    &Engine::startHeapSort,
+    &Engine::timSort,
+    &Engine::countingSort,
+    &Engine::radixSort,
+    &Engine::bucketSort,
+    &Engine::parallelMergeSort,
+    &Engine::parallelQuickSort,
+    &Engine::bitonicSort,
+    &Engine::parallelSampleSort,
+    &Engine::nthElement,
+    &Engine::topK,
+    &Engine::partialSort,
+};
+
+template <class Engine>
+const AlgorithmInfo& autoAlgorithm(const Engine& engine); // Defined with the selector below
+
+template <class Engine>
+SortTask runAlgorithm(Engine& engine, const AlgorithmInfo& info) {
+    const AlgorithmInfo& chosen = info.automatic ? autoAlgorithm(engine) : info;
+    return (engine.*algorithmRunners<Engine>[&chosen - algorithms.data()])();
+}
+
+enum class Distribution { Uniform, Sorted, Reversed, NearlySorted, FewUnique, OrganPipe, Sawtooth, Zipf, Gaussian };
+
+struct DistributionInfo {
+    const char* id; // Name used on the command line
+    const char* name;
+    Distribution kind;
+};
+
+const std::vector<DistributionInfo> distributions = {
+    {"uniform", "Uniform", Distribution::Uniform},
+    {"sorted", "Sorted", Distribution::Sorted},
+    {"reversed", "Reversed", Distribution::Reversed},
+    {"nearly", "Nearly sorted", Distribution::NearlySorted},
+    {"few", "Few unique", Distribution::FewUnique},
+    {"organ", "Organ pipe", Distribution::OrganPipe},
+    {"sawtooth", "Sawtooth", Distribution::Sawtooth},
+    {"zipf", "Zipf", Distribution::Zipf},
+    {"gaussian", "Gaussian", Distribution::Gaussian},
+};
+
+// Small, fast generator for input data. Each block of the input gets its own stream derived
+// from the seed and the block index, so the output doesn't depend on how blocks are scheduled.
+class SplitMix64 {
+private:
+    uint64_t state;
+
+public:
+    using result_type = uint64_t;
+
+    explicit SplitMix64(uint64_t seed) : state(seed) {}
+
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return UINT64_MAX; }
+
+    uint64_t operator()() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, 1).
+    double unit() { return ((*this)() >> 11) * 0x1.0p-53; }
+};
+
+// Fills inputs with a seeded distribution of keys in [low, high]. The ramps behind sorted,
+// reversed, organ pipe and sawtooth are computed per element, random values come from one
+// SplitMix64 stream per block, and blocks are filled in parallel on the pool. Nearly sorted
+// is a ramp with `swaps` random swaps (n/100 when 0) applied afterwards.
+class InputGenerator {
+public:
+    Distribution distribution = Distribution::Uniform;
+    uint64_t seed = 42;
+    double low = 0;
+    double high = 1000000;
+    size_t swaps = 0;
+    ThreadPool* pool = nullptr; // The shared pool if unset
+
+    template <typename Key>
+    void fill(std::vector<Key>& out, size_t size) const {
+        out.resize(size);
+        if (size == 0) return;
+        const size_t n = size;
+        std::vector<double> zipfCdf;
+        if (distribution == Distribution::Zipf) zipfCdf = zipfTable();
+
+        auto value = [&](double position) { return toKey<Key>(low + (high - low) * position); };
+        auto ramp = [n](size_t i) { return n > 1 ? double(i) / double(n - 1) : 0.0; };
+        const double pipeHalf = std::max((n - 1) / 2.0, 1.0);
+        auto fillBlock = [&](size_t block) {
+            size_t from = block * blockSize, to = std::min(n, from + blockSize);
+            SplitMix64 random(mix(seed, block));
+            for (size_t i = from; i < to; ++i) {
+                switch (distribution) {
+                    case Distribution::Uniform:
+                        out[i] = uniformKey<Key>(random);
+                        break;
+                    case Distribution::Sorted:
+                    case Distribution::NearlySorted:
+                        out[i] = value(ramp(i));
+                        break;
+                    case Distribution::Reversed:
+                        out[i] = value(ramp(n - 1 - i));
+                        break;
+                    case Distribution::FewUnique:
+                        out[i] = value(double(random() % fewUniqueValues) / (fewUniqueValues - 1));
+                        break;
+                    case Distribution::OrganPipe:
+                        out[i] = value(std::min(1.0, double(std::min(i, n - 1 - i)) / pipeHalf));
+                        break;
+                    case Distribution::Sawtooth: {
+                        size_t period = (n + sawtoothTeeth - 1) / sawtoothTeeth;
+                        out[i] = value(period > 1 ? double(i % period) / double(period - 1) : 0.0);
+                        break;
+                    }
+                    case Distribution::Zipf: {
+                        size_t rank = std::upper_bound(zipfCdf.begin(), zipfCdf.end(), random.unit()) - zipfCdf.begin();
+                        out[i] = value(double(rank) / double(zipfCdf.size() - 1));
+                        break;
+                    }
+                    case Distribution::Gaussian:
+                        out[i] = value(std::clamp(0.5 + normal(random) / 6, 0.0, 1.0));
+                        break;
+                }
+            }
+        };
+
+        size_t blocks = (n + blockSize - 1) / blockSize;
+        if (blocks == 1) {
+            fillBlock(0);
+        } else {
+            ThreadPool& workers = pool ? *pool : sharedThreadPool();
+            TaskGroup group(workers);
+            for (size_t b = 1; b < blocks; ++b) {
+                group.run([&fillBlock, b] { fillBlock(b); });
+            }
+            fillBlock(0);
+            group.wait();
+        }
+
+        if (distribution == Distribution::NearlySorted && n > 1) {
+            SplitMix64 random(mix(seed, blocks));
+            size_t count = swaps ? swaps : std::max<size_t>(n / 100, 1);
+            for (size_t k = 0; k < count; ++k) {
+                std::swap(out[random() % n], out[random() % n]);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t blockSize = 1 << 16;
+    static constexpr uint64_t fewUniqueValues = 8;
+    static constexpr size_t sawtoothTeeth = 8;
+    static constexpr double zipfExponent = 1.0;
+    static constexpr size_t maxZipfRanks = 1 << 16;
+
+    static uint64_t mix(uint64_t seed, uint64_t stream) {
+        return SplitMix64(seed ^ (stream * 0xd1b54a32d192ed03ULL))();
+    }
+
+    template <typename Key>
+    static Key toKey(double x) {
+        if constexpr (std::is_integral_v<Key>) {
+            return static_cast<Key>(std::llround(x));
+        } else {
+            return static_cast<Key>(x);
+        }
+    }
+
+    template <typename Key>
+    Key uniformKey(SplitMix64& random) const {
+        if constexpr (std::is_integral_v<Key>) {
+            uint64_t span = static_cast<uint64_t>(toKey<Key>(high) - toKey<Key>(low)) + 1;
+            return static_cast<Key>(toKey<Key>(low) + static_cast<Key>(span ? random() % span : random()));
+        } else {
+            return static_cast<Key>(low + (high - low) * random.unit());
+        }
+    }
+
+    // Box-Muller; one of the pair is thrown away so every value depends only on its block.
+    static double normal(SplitMix64& random) {
+        double u = 1.0 - random.unit();
+        return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * std::numbers::pi * random.unit());
+    }
+
+    // Cumulative probabilities of ranks 0..m-1 with weight 1/(rank+1)^s, where m is the number
+    // of distinct values in [low, high] up to maxZipfRanks. Rank 0 maps to `low`.
+    std::vector<double> zipfTable() const {
+        size_t ranks = std::clamp<size_t>(static_cast<size_t>(high - low) + 1, 2, maxZipfRanks);
+        std::vector<double> cdf(ranks);
+        double sum = 0;
+        for (size_t r = 0; r < ranks; ++r) {
+            sum += 1.0 / std::pow(double(r + 1), zipfExponent);
+            cdf[r] = sum;
+        }
+        for (double& c : cdf) c /= sum;
+        return cdf;
+    }
+};
+
+// Cheap statistics of an input, from at most profileSamples elements: the key range, the share
+// of sampled keys that repeat, the share of sampled neighbours that descend (about runs / n) and
+// the share of sampled pairs that are inverted (0 sorted, 0.5 random, 1 reversed).
+struct InputProfile {
+    size_t size = 0;
+    double range = 0; // Largest minus smallest sampled key
+    double duplicates = 0;
+    double descents = 0;
+    double inversions = 0;
+
+    // Position in the space the selector measures distances in. Sizes and ranges are compared
+    // on a log scale, range per key rather than range, since that is what counting sort pays.
+    std::array<double, 5> features() const {
+        double logSize = std::log2(std::max<double>(double(size), 1));
+        return {logSize, std::log2(range + 1) - logSize, duplicates, descents, inversions};
+    }
+};
+
+constexpr size_t profileSamples = 1024;
+
+template <class T, class KeyOf, class Less>
+InputProfile profileInput(const std::vector<T>& arr, const KeyOf& keyOf, const Less& less) {
+    using Key = std::decay_t<decltype(keyOf(arr[0]))>;
+    InputProfile profile;
+    const size_t n = arr.size();
+    profile.size = n;
+    if (n < 2) return profile;
+    // One position from each of s equal strata, so small inputs are sampled completely.
+    const size_t s = std::min(n, profileSamples);
+    SplitMix64 random(n);
+    std::vector<size_t> positions(s);
+    for (size_t i = 0; i < s; ++i) {
+        size_t from = n * i / s, to = n * (i + 1) / s;
+        positions[i] = from + random() % (to - from);
+    }
+    std::vector<Key> keys(s);
+    size_t descents = 0, inversions = 0, neighbours = 0, pairs = 0;
+    for (size_t i = 0; i < s; ++i) {
+        size_t at = positions[i];
+        keys[i] = keyOf(arr[at]);
+        if (at + 1 < n) {
+            ++neighbours;
+            descents += less(keyOf(arr[at + 1]), keys[i]);
+        }
+        size_t a = random() % s, b = random() % s;
+        if (a == b) continue;
+        if (a > b) std::swap(a, b);
+        ++pairs;
+        inversions += less(keyOf(arr[positions[b]]), keyOf(arr[positions[a]]));
+    }
+    std::sort(keys.begin(), keys.end(), less);
+    size_t repeats = 0;
+    for (size_t i = 1; i < s; ++i) {
+        repeats += !less(keys[i - 1], keys[i]);
+    }
+    if constexpr (std::is_arithmetic_v<Key>) profile.range = double(keys.back()) - double(keys.front());
+    profile.duplicates = double(repeats) / s;
+    profile.descents = neighbours ? double(descents) / neighbours : 0;
+    profile.inversions = pairs ? double(inversions) / pairs : 0;
+    return profile;
+}
+
+// A benchmarked input and the algorithm that sorted it fastest.
+struct CalibrationPoint {
+    InputProfile profile;
+    std::string algorithm; // Id of the winner
+    double nsPerElement;
+    std::string input; // Distribution and size it was generated with, for the details panel
+};
+
+// Recorded with `--bench --sizes 100,1e3,1e4,1e5,1e6 --reps 1 --threads 1` on every distribution, once with
+// --max-value 400 and once with the default 1e6, on a single-core machine; --auto-table replaces
+// it with results from the machine at hand. The quadratic sorts are left out (see autoCandidate).
+const CalibrationPoint defaultCalibration[] = {
+    {{100, 1000000, 0.920, 0.434, 0.535}, "bucket", 63.580, "few, n=100"},
+    {{100, 802500, 0.000, 0.455, 0.515}, "merge", 68.210, "gaussian, n=100"},
+    {{100, 1000000, 0.000, 0.000, 0.000}, "tim", 22.300, "nearly, n=100"},
+    {{100, 989899, 0.500, 0.495, 0.525}, "merge", 60.800, "organ, n=100"},
+    {{100, 1000000, 0.000, 1.000, 1.000}, "tim", 34.320, "reversed, n=100"},
+    {{100, 1000000, 0.870, 0.071, 0.333}, "quick", 57.840, "sawtooth, n=100"},
+    {{100, 1000000, 0.000, 0.000, 0.000}, "tim", 24.630, "sorted, n=100"},
+    {{100, 995272, 0.000, 0.475, 0.556}, "bucket", 97.860, "uniform, n=100"},
+    {{100, 888563, 0.200, 0.455, 0.535}, "merge", 65.320, "zipf, n=100"},
+    {{1000, 1000000, 0.992, 0.450, 0.423}, "bucket", 65.617, "few, n=1000"},
+    {{1000, 1000000, 0.003, 0.490, 0.499}, "bucket", 79.977, "gaussian, n=1000"},
+    {{1000, 1000000, 0.000, 0.020, 0.009}, "pquick", 49.785, "nearly, n=1000"},
+    {{1000, 998999, 0.500, 0.499, 0.501}, "bucket", 56.609, "organ, n=1000"},
+    {{1000, 1000000, 0.000, 1.000, 1.000}, "tim", 31.514, "reversed, n=1000"},
+    {{1000, 1000000, 0.875, 0.007, 0.448}, "bucket", 62.990, "sawtooth, n=1000"},
+    {{1000, 1000000, 0.000, 0.000, 0.000}, "tim", 20.694, "sorted, n=1000"},
+    {{1000, 996079, 0.001, 0.503, 0.511}, "bucket", 73.796, "uniform, n=1000"},
+    {{1000, 983810, 0.417, 0.482, 0.465}, "bucket", 99.036, "zipf, n=1000"},
+    {{10000, 1000000, 0.992, 0.435, 0.429}, "quick", 54.406, "few, n=10000"},
+    {{10000, 1000000, 0.002, 0.489, 0.494}, "bucket", 77.425, "gaussian, n=10000"},
+    {{10000, 998800, 0.000, 0.011, 0.016}, "pquick", 36.126, "nearly, n=10000"},
+    {{10000, 998500, 0.044, 0.500, 0.496}, "bucket", 51.381, "organ, n=10000"},
+    {{10000, 998800, 0.000, 1.000, 1.000}, "tim", 29.500, "reversed, n=10000"},
+    {{10000, 1000000, 0.278, 0.001, 0.462}, "pmerge", 40.498, "sawtooth, n=10000"},
+    {{10000, 998800, 0.000, 0.000, 0.000}, "tim", 17.942, "sorted, n=10000"},
+    {{10000, 994255, 0.001, 0.521, 0.511}, "bucket", 53.965, "uniform, n=10000"},
+    {{10000, 993011, 0.389, 0.487, 0.455}, "bucket", 73.645, "zipf, n=10000"},
+    {{100000, 1000000, 0.992, 0.441, 0.458}, "quick", 56.934, "few, n=100000"},
+    {{100000, 981773, 0.003, 0.493, 0.514}, "bucket", 70.555, "gaussian, n=100000"},
+    {{100000, 998610, 0.000, 0.022, 0.013}, "pquick", 48.047, "nearly, n=100000"},
+    {{100000, 998310, 0.004, 0.500, 0.508}, "bucket", 48.195, "organ, n=100000"},
+    {{100000, 998610, 0.000, 1.000, 1.000}, "tim", 28.019, "reversed, n=100000"},
+    {{100000, 999120, 0.039, 0.000, 0.443}, "pmerge", 44.691, "sawtooth, n=100000"},
+    {{100000, 998610, 0.000, 0.000, 0.000}, "tim", 17.731, "sorted, n=100000"},
+    {{100000, 998543, 0.000, 0.490, 0.477}, "bucket", 69.152, "uniform, n=100000"},
+    {{100000, 996170, 0.414, 0.473, 0.486}, "bucket", 71.803, "zipf, n=100000"},
+    {{1000000, 1000000, 0.992, 0.455, 0.431}, "counting", 12.516, "few, n=1000000"},
+    {{1000000, 1000000, 0.000, 0.502, 0.490}, "counting", 19.069, "gaussian, n=1000000"},
+    {{1000000, 999676, 0.000, 0.019, 0.015}, "counting", 12.677, "nearly, n=1000000"},
+    {{1000000, 999319, 0.001, 0.500, 0.489}, "counting", 9.223, "organ, n=1000000"},
+    {{1000000, 999676, 0.000, 1.000, 1.000}, "counting", 12.303, "reversed, n=1000000"},
+    {{1000000, 997632, 0.004, 0.000, 0.441}, "counting", 12.729, "sawtooth, n=1000000"},
+    {{1000000, 999676, 0.000, 0.000, 0.000}, "counting", 17.072, "sorted, n=1000000"},
+    {{1000000, 998653, 0.000, 0.530, 0.490}, "counting", 35.037, "uniform, n=1000000"},
+    {{1000000, 996628, 0.383, 0.514, 0.494}, "counting", 13.855, "zipf, n=1000000"},
+    {{100, 400, 0.920, 0.424, 0.444}, "counting", 40.900, "few, n=100"},
+    {{100, 352, 0.180, 0.545, 0.455}, "counting", 43.470, "gaussian, n=100"},
+    {{100, 400, 0.000, 0.020, 0.000}, "counting", 29.840, "nearly, n=100"},
+    {{100, 396, 0.500, 0.495, 0.525}, "counting", 31.690, "organ, n=100"},
+    {{100, 400, 0.000, 1.000, 1.000}, "counting", 31.420, "reversed, n=100"},
+    {{100, 400, 0.870, 0.071, 0.333}, "counting", 30.970, "sawtooth, n=100"},
+    {{100, 400, 0.000, 0.000, 0.000}, "tim", 23.060, "sorted, n=100"},
+    {{100, 390, 0.160, 0.485, 0.434}, "bucket", 95.920, "uniform, n=100"},
+    {{100, 385, 0.360, 0.485, 0.535}, "counting", 50.580, "zipf, n=100"},
+    {{1000, 400, 0.992, 0.453, 0.442}, "counting", 12.875, "few, n=1000"},
+    {{1000, 366, 0.730, 0.501, 0.515}, "counting", 17.931, "gaussian, n=1000"},
+    {{1000, 400, 0.599, 0.020, 0.014}, "counting", 10.820, "nearly, n=1000"},
+    {{1000, 400, 0.599, 0.400, 0.501}, "counting", 11.346, "organ, n=1000"},
+    {{1000, 400, 0.599, 0.400, 0.998}, "counting", 11.447, "reversed, n=1000"},
+    {{1000, 400, 0.875, 0.007, 0.448}, "counting", 11.556, "sawtooth, n=1000"},
+    {{1000, 400, 0.599, 0.000, 0.000}, "counting", 10.287, "sorted, n=1000"},
+    {{1000, 400, 0.626, 0.483, 0.506}, "counting", 18.302, "uniform, n=1000"},
+    {{1000, 393, 0.767, 0.479, 0.550}, "counting", 17.990, "zipf, n=1000"},
+    {{10000, 400, 0.992, 0.450, 0.430}, "counting", 7.757, "few, n=10000"},
+    {{10000, 396, 0.738, 0.480, 0.468}, "counting", 7.838, "gaussian, n=10000"},
+    {{10000, 400, 0.608, 0.018, 0.015}, "counting", 6.588, "nearly, n=10000"},
+    {{10000, 400, 0.609, 0.042, 0.495}, "counting", 6.910, "organ, n=10000"},
+    {{10000, 400, 0.608, 0.035, 0.998}, "counting", 6.467, "reversed, n=10000"},
+    {{10000, 400, 0.633, 0.001, 0.462}, "counting", 6.272, "sawtooth, n=10000"},
+    {{10000, 400, 0.608, 0.000, 0.000}, "counting", 6.969, "sorted, n=10000"},
+    {{10000, 399, 0.636, 0.511, 0.453}, "counting", 10.410, "uniform, n=10000"},
+    {{10000, 400, 0.752, 0.495, 0.508}, "counting", 8.289, "zipf, n=10000"},
+    {{100000, 400, 0.992, 0.446, 0.454}, "counting", 6.889, "few, n=100000"},
+    {{100000, 400, 0.720, 0.484, 0.506}, "counting", 7.045, "gaussian, n=100000"},
+    {{100000, 400, 0.608, 0.023, 0.019}, "counting", 5.883, "nearly, n=100000"},
+    {{100000, 400, 0.609, 0.001, 0.508}, "counting", 6.140, "organ, n=100000"},
+    {{100000, 400, 0.608, 0.002, 0.997}, "counting", 5.486, "reversed, n=100000"},
+    {{100000, 400, 0.628, 0.000, 0.443}, "counting", 5.749, "sawtooth, n=100000"},
+    {{100000, 400, 0.608, 0.000, 0.000}, "counting", 5.606, "sorted, n=100000"},
+    {{100000, 399, 0.639, 0.490, 0.535}, "counting", 9.086, "uniform, n=100000"},
+    {{100000, 400, 0.745, 0.475, 0.484}, "counting", 7.328, "zipf, n=100000"},
+    {{1000000, 400, 0.992, 0.427, 0.416}, "counting", 8.513, "few, n=1000000"},
+    {{1000000, 400, 0.718, 0.518, 0.526}, "counting", 9.088, "gaussian, n=1000000"},
+    {{1000000, 400, 0.608, 0.022, 0.018}, "counting", 6.652, "nearly, n=1000000"},
+    {{1000000, 400, 0.613, 0.000, 0.488}, "counting", 6.041, "organ, n=1000000"},
+    {{1000000, 400, 0.608, 0.001, 1.000}, "counting", 6.473, "reversed, n=1000000"},
+    {{1000000, 399, 0.632, 0.000, 0.441}, "counting", 6.120, "sawtooth, n=1000000"},
+    {{1000000, 400, 0.608, 0.000, 0.000}, "counting", 5.752, "sorted, n=1000000"},
+    {{1000000, 400, 0.636, 0.517, 0.530}, "counting", 7.585, "uniform, n=1000000"},
+    {{1000000, 398, 0.770, 0.472, 0.482}, "counting", 9.343, "zipf, n=1000000"},
+};
+
+// Whether Auto may dispatch to the algorithm: a full sort that isn't quadratic. A sample can't
+// tell sorted input from input with a few misplaced keys, so a quadratic sort that won on
+// sorted input could take O(n^2) on nearly sorted input that profiles the same.
+bool autoCandidate(const AlgorithmInfo& info) {
+    return !info.automatic && !info.quadratic && info.output == SortOutput::Sorted;
+}
+
+std::vector<CalibrationPoint>& calibration() {
+    static std::vector<CalibrationPoint> points(std::begin(defaultCalibration), std::end(defaultCalibration));
+    return points;
+}
+
+// Replaces the calibration with the winners in a CSV written by --bench: for every input
+// (distribution, size, key, layout, seed) the algorithm with the lowest ns_per_element wins.
+// Several files can be concatenated; repeated header lines are skipped.
+bool loadCalibration(const std::string& path, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::vector<std::string> header;
+    std::map<std::string, CalibrationPoint> winners;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> cells;
+        std::stringstream ss(line);
+        std::string cell;
+        while (std::getline(ss, cell, ',')) cells.push_back(cell);
+        if (!cells.empty() && cells[0] == "algorithm") {
+            header = cells;
+            continue;
+        }
+        auto column = [&](const char* name) -> const std::string& {
+            auto it = std::find(header.begin(), header.end(), name);
+            if (it == header.end() || size_t(it - header.begin()) >= cells.size()) throw std::invalid_argument(std::string("missing column ") + name);
+            return cells[it - header.begin()];
+        };
+        try {
+            if (header.empty() || cells.empty()) continue;
+            const std::string& id = column("algorithm");
+            const AlgorithmInfo* info = findAlgorithm(id);
+            if (!info || !autoCandidate(*info) || column("sorted") != "1") continue;
+            CalibrationPoint point;
+            point.profile.size = static_cast<size_t>(std::stod(column("size")));
+            point.profile.range = std::stod(column("range"));
+            point.profile.duplicates = std::stod(column("duplicates"));
+            point.profile.descents = std::stod(column("descents"));
+            point.profile.inversions = std::stod(column("inversions"));
+            point.algorithm = id;
+            point.nsPerElement = std::stod(column("ns_per_element"));
+            point.input = column("distribution") + ", n=" + column("size");
+            std::string key = column("distribution") + "," + column("size") + "," + column("key") + "," + column("layout") + "," + column("seed");
+            auto [it, inserted] = winners.emplace(key, point);
+            if (!inserted && point.nsPerElement < it->second.nsPerElement) it->second = point;
+        } catch (const std::exception& e) {
+            error = path + ": " + e.what();
+            return false;
+        }
+    }
+    if (winners.empty()) {
+        error = path + " has no benchmark results";
+        return false;
+    }
+    calibration().clear();
+    for (auto& [key, point] : winners) calibration().push_back(std::move(point));
+    return true;
+}
+
+struct AutoChoice {
+    const AlgorithmInfo* algorithm;
+    const CalibrationPoint* nearest;
+    double distance;
+};
+
+// Nearest calibrated input to the profile. A factor of four in size or range per key counts
+// as much as a difference of 0.25 in the share of duplicates, descents or inversions.
+AutoChoice chooseAlgorithm(const InputProfile& profile) {
+    static const double weights[] = {0.5, 0.5, 4, 4, 4};
+    std::array<double, 5> target = profile.features();
+    AutoChoice choice{findAlgorithm("quick"), nullptr, INFINITY}; // Quick Sort if nothing is calibrated
+    for (const CalibrationPoint& point : calibration()) {
+        std::array<double, 5> features = point.profile.features();
+        double distance = 0;
+        for (size_t f = 0; f < features.size(); ++f) {
+            double d = (features[f] - target[f]) * weights[f];
+            distance += d * d;
+        }
+        distance = std::sqrt(distance);
+        const AlgorithmInfo* info = findAlgorithm(point.algorithm);
+        if (distance < choice.distance && info && autoCandidate(*info)) {
+            choice = {info, &point, distance};
+        }
+    }
+    return choice;
+}
+
+// What Auto measured and why it picked its algorithm, for the details panel.
+std::string describeChoice(const InputProfile& profile, const AutoChoice& choice) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(0) << "Sampled " << std::min(profile.size, profileSamples) << " of " << profile.size
+       << " keys: range " << profile.range << ", " << 100 * profile.duplicates << "% repeated, " << 100 * profile.descents
+       << "% descents, " << 100 * profile.inversions << "% inverted pairs.\n";
+    if (choice.nearest) {
+        ss << "Most similar benchmarked input: " << choice.nearest->input << ", range " << choice.nearest->profile.range << " (distance " << std::setprecision(2) << choice.distance
+           << "), where " << choice.algorithm->name << " was fastest at " << std::setprecision(1) << choice.nearest->nsPerElement << " ns/key.";
+    } else {
+        ss << "No calibration loaded, using " << choice.algorithm->name << ".";
+    }
+    return ss.str();
+}
+
+template <class Engine>
+const AlgorithmInfo& autoAlgorithm(const Engine& engine) {
+    return *chooseAlgorithm(profileInput(engine.arr, engine.keyOf, engine.less)).algorithm;
+}
+
+// Hardware counters through perf_event_open (Linux only). Counters are opened once, before
+// any other thread starts, with `inherit` set so every thread created afterwards (the pools)
+// is counted as well; a measurement is the difference of two reads. Only user-space events
+// are counted, which perf_event_paranoid <= 2 allows. A counter the kernel refuses stays
+// unavailable and is reported as such.
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, L1dMisses, LlcMisses, BranchMisses, EventCount };
+
+    struct Sample {
+        std::array<uint64_t, EventCount> values{};
+        std::array<bool, EventCount> valid{};
+
+        Sample operator-(const Sample& start) const {
+            Sample delta;
+            for (int e = 0; e < EventCount; ++e) {
+                delta.valid[e] = valid[e] && start.valid[e];
+                delta.values[e] = delta.valid[e] ? values[e] - std::min(values[e], start.values[e]) : 0;
+            }
+            return delta;
+        }
+
+        Sample& operator+=(const Sample& other) {
+            for (int e = 0; e < EventCount; ++e) {
+                values[e] += other.values[e];
+                valid[e] = other.valid[e];
+            }
+            return *this;
+        }
+
+        bool any() const { return std::find(valid.begin(), valid.end(), true) != valid.end(); }
+    };
+
+    static const char* name(int event) {
+        static const char* names[EventCount] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+        return names[event];
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) ::close(fd);
+        }
+#endif
+    }
+
+    // Opens every counter it can. Returns false, with the reason in status(), if none opened.
+    bool open() {
+#ifdef __linux__
+        const std::pair<uint32_t, uint64_t> configs[EventCount] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        int firstError = 0;
+        for (int e = 0; e < EventCount; ++e) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = configs[e].first;
+            attr.config = configs[e].second;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds[e] < 0 && !firstError) firstError = errno;
+        }
+        if (read().any()) {
+            opened = true;
+            statusText = "ok";
+            return true;
+        }
+        statusText = firstError == EACCES || firstError == EPERM ? "not permitted"
+                   : firstError == ENOENT || firstError == EOPNOTSUPP ? "not supported"
+                   : std::string("unavailable (") + std::strerror(firstError) + ")";
+        return false;
+#else
+        statusText = "only available on Linux";
+        return false;
+#endif
+    }
+
+    // Current totals, scaled up when the kernel had to multiplex a counter.
+    Sample read() const {
+        Sample sample;
+#ifdef __linux__
+        for (int e = 0; e < EventCount; ++e) {
+            uint64_t raw[3]; // value, time enabled, time running
+            if (fds[e] < 0 || ::read(fds[e], raw, sizeof(raw)) != static_cast<ssize_t>(sizeof(raw))) continue;
+            sample.valid[e] = raw[2] > 0;
+            sample.values[e] = raw[2] > 0 && raw[2] < raw[1] ? static_cast<uint64_t>(double(raw[0]) * raw[1] / raw[2]) : raw[0];
+        }
+#endif
+        return sample;
+    }
+
+    bool available() const { return opened; }
+    const std::string& status() const { return statusText; }
+
+private:
+    bool opened = false;
+    int fds[EventCount] = {-1, -1, -1, -1, -1};
+    std::string statusText = "not opened";
+};
+
+// The process-wide counters, opened at the start of main().
+PerfCounters& processCounters() {
+    static PerfCounters counters;
+    return counters;
+}
+
+// State of an external sort shared between the sorting thread and the window. The run
+// layout is fixed before the sorting thread starts; everything else is atomic.
+struct ExternalProgress {
+    enum Phase { Forming, Merging, Done, Failed };
+    std::atomic<int> phase{Forming};
+    std::atomic<bool> cancelled{false};
+    std::string algorithm;
+    uint64_t totalKeys = 0;
+    std::vector<uint64_t> runLengths;
+    std::unique_ptr<std::atomic<uint64_t>[]> runsMerged; // Keys of each run already merged
+    std::atomic<size_t> runsFormed{0};
+    std::atomic<uint64_t> keysWritten{0}; // By the merge
+    std::string error; // Set before phase becomes Failed
+
+    void setRuns(uint64_t keys, uint64_t keysPerRun) {
+        totalKeys = keys;
+        runLengths.clear();
+        for (uint64_t start = 0; start < keys; start += keysPerRun) {
+            runLengths.push_back(std::min(keysPerRun, keys - start));
+        }
+        runsMerged = std::make_unique<std::atomic<uint64_t>[]>(runLengths.size());
+        for (size_t r = 0; r < runLengths.size(); ++r) runsMerged[r] = 0;
+    }
+};
+
+// Level-of-detail view of an array with more elements than pixel columns. Each column keeps a
+// histogram of the pixel rows its elements reach, from which the min/max envelope and the mean
+// follow, and a heat value counting recent accesses. A write moves one element between two
+// histogram rows, so aggregates are updated from the changed indices only; a column's envelope
+// is recomputed from its histogram (not its elements) the next time it is read.
+class ColumnSummary {
+public:
+    size_t columns() const { return heat.size(); }
+
+    // Builds every column from scratch; used when the whole array changes.
+    void reset(const std::vector<int>& arr, size_t columnCount, size_t rowCount, float valueScale) {
+        size = arr.size();
+        rows = rowCount;
+        scale = valueScale;
+        rowOf.resize(size);
+        counts.assign(columnCount * rows, 0);
+        rowSum.assign(columnCount, 0);
+        lowest.assign(columnCount, 0);
+        highest.assign(columnCount, 0);
+        heat.assign(columnCount, 0.0f);
+        stale.assign(columnCount, 1);
+        for (size_t c = 0; c < columnCount; ++c) {
+            for (size_t i = firstOf(c); i < firstOf(c + 1); ++i) {
+                uint16_t row = rowFor(arr[i]);
+                rowOf[i] = row;
+                counts[c * rows + row]++;
+                rowSum[c] += row;
+            }
+        }
+    }
+
+    void update(size_t index, int value) {
+        if (index >= size) return;
+        uint16_t row = rowFor(value), old = rowOf[index];
+        if (row == old) return;
+        size_t c = columnOf(index);
+        counts[c * rows + old]--;
+        counts[c * rows + row]++;
+        rowSum[c] += int64_t(row) - old;
+        rowOf[index] = row;
+        stale[c] = 1;
+    }
+
+    void touch(size_t index) {
+        if (index < size) heat[columnOf(index)] += 1.0f;
+    }
+
+    // Lets recent accesses fade: called once per frame.
+    void cool(float factor) {
+        for (float& h : heat) h *= factor;
+    }
+
+    size_t elementsIn(size_t c) const { return firstOf(c + 1) - firstOf(c); }
+    float meanRow(size_t c) const { return elementsIn(c) ? float(rowSum[c]) / elementsIn(c) : 0.0f; }
+    float heatOf(size_t c) const { return heat[c]; }
+
+    // Lowest and highest row reached in column c.
+    std::pair<size_t, size_t> envelope(size_t c) {
+        if (stale[c]) {
+            const uint32_t* count = &counts[c * rows];
+            size_t low = 0, high = rows - 1;
+            while (low < rows && !count[low]) ++low;
+            while (high > low && !count[high]) --high;
+            lowest[c] = low < rows ? low : 0;
+            highest[c] = low < rows ? high : 0;
+            stale[c] = 0;
+        }
+        return {lowest[c], highest[c]};
+    }
+
+private:
+    size_t size = 0;
+    size_t rows = 1;
+    float scale = 1.0f;
+    std::vector<uint16_t> rowOf; // Row each element is counted in
+    std::vector<uint32_t> counts; // columns x rows histogram
+    std::vector<int64_t> rowSum;
+    std::vector<size_t> lowest, highest; // Cached envelope, valid unless stale
+    std::vector<float> heat;
+    std::vector<uint8_t> stale;
+
+    size_t firstOf(size_t c) const { return c * size / heat.size(); }
+    size_t columnOf(size_t index) const { return ((index + 1) * heat.size() - 1) / size; }
+    uint16_t rowFor(int value) const { return static_cast<uint16_t>(std::clamp(value * scale, 0.0f, float(rows - 1))); }
+};
 
 class SortingVisualizer {
 private:
-    sf::RenderWindow& window;
-    std::vector<int> arr;
-    std::vector<sf::RectangleShape> bars;
+    sf::RenderTarget& target;
+    sf::RenderWindow* window; // Null when rendering offscreen, e.g. for --export
+    SortEngine engine;
+    SortTask task;
+    InputGenerator generator; // Values in [10, 400]; R moves to the next seed
+    size_t distributionIndex = 0;
+    TraceReader replay;
+    bool isReplaying;
+    const ExternalProgress* external = nullptr; // Set while watching an external sort
+    int externalPhase = -1; // Phase shown in the details panel
+    sf::VertexArray runBars; // One quad per run of the external sort
+    int replayDirection; // 1 plays forward, -1 backward
+    sf::VertexArray bars; // All bars in one batch, drawn with a single draw call
+    size_t verticesPerBar;
+    bool lod = false; // More elements than pixel columns: bars holds one envelope per column instead
+    ColumnSummary columns; // Per-column aggregates while lod is set
+    sf::Color lodBase; // Color of columns without recent accesses
+    std::vector<size_t> highlighted; // Bars touched during the current frame
+    std::vector<uint32_t> highlightFrame; // Frame in which each bar was last highlighted
+    std::vector<unsigned> barOwner; // Worker that last wrote each bar (or tint of its run), 0 for none
+    PerfCounters::Sample runCounters; // Hardware counters over the steps of the current run
+    std::vector<CacheSimulator::LevelConfig> cacheLevels = CacheSimulator::defaultLevels();
+    unsigned cacheLine = 64;
+    std::unique_ptr<CacheSimulator> cache; // Attached to the engine while M has it switched on
+
+    // One algorithm of a race, sorting its own copy of the input on its own thread. After each
+    // slice of steps the thread publishes a copy of the array; the render thread only ever reads
+    // that copy, and the engine's counters, which are safe to read while the lane runs.
+    struct RaceLane {
+        const AlgorithmInfo* info = nullptr;
+        SortEngine engine;
+        std::unique_ptr<ThreadPool> pool; // Parallel algorithms get their own so lanes can't starve each other
+        std::thread thread;
+        std::mutex mutex; // Guards the fields below
+        std::vector<int> snapshot;
+        SortStep lastStep{};
+        double elapsedMs = 0; // Pauses excluded
+        int place = 0; // Finish position, 0 while running
+        std::string failure; // What stopped the algorithm, if it threw; failed lanes get no place
+    };
+    std::vector<std::unique_ptr<RaceLane>> lanes; // Non-empty while a race is shown
+    std::vector<size_t> raceAlgorithms = {3, 4, 5, 6}; // Quick, Merge, Heap, Tim unless --race says otherwise
+    std::atomic<bool> raceStopping{false};
+    std::atomic<bool> racePaused{false};
+    std::atomic<double> raceSpeed{0}; // opsPerSecond, readable from the lane threads
+    std::atomic<int> raceFinished{0};
+    sf::VertexArray raceBars;
+    std::vector<sf::Text> raceLabels;
+    unsigned runsShown = 0;
+    uint32_t frameNumber;
+    size_t markedIndex;
     float barWidth;
-    int delayMs;
+    float valueScale; // Pixels per unit of value
+    double opsPerSecond; // Target speed, changed in powers of two with +/-
+    double pendingSteps;
+    std::chrono::steady_clock::time_point lastAdvance;
     bool isSorting;
     bool isPaused;
     std::string currentAlgorithm;
+    std::string currentDetails;
     std::string algorithmDetails;
+    std::unordered_map<std::string, std::string> wrappedParagraphs; // Layouts already computed by wrapText
+    std::array<float, 128> glyphAdvance{}; // Of each ASCII character in the details font
+    std::string shownStats; // What statsText currently holds
+    bool statsDirty = true; // Set by updateStats, cleared when draw() formats the panel
     sf::Font font;
     sf::Text detailsText;
     sf::Text instructionsText;
     sf::Text statsText;
     std::vector<sf::Text> algorithmButtons;
-    unsigned long long comparisons;
-    unsigned long long swaps;
     sf::RectangleShape controlPanel;
     sf::RectangleShape statsPanel;
     size_t activeAlgorithmIndex;
+    std::vector<int> selectionInput; // Input of a running selection algorithm, for the full sort it is compared with
+    size_t selectChoice = 0; // Position in the cycle of the K key
+
+    static constexpr float frameBudgetMs = 12.0f; // Of each 16 ms frame; the rest is left for events and rendering
+    static constexpr double minOpsPerSecond = 1.0;
+    static constexpr double maxOpsPerSecond = 1 << 27;
+    static constexpr size_t lodColumns = 800; // One per pixel of the window width
+    static constexpr float heatDecay = 0.85f; // Per frame
+
+    void setBarColor(size_t index, sf::Color color) {
+        if (!lod && index < engine.arr.size()) {
+            sf::Vertex* v = &bars[index * verticesPerBar];
+            for (size_t k = 0; k < verticesPerBar; ++k) {
+                v[k].color = color;
+            }
+        }
+    }
+
+    // Rewrites the vertices of one bar in place. Bars narrower than two pixels are drawn as
+    // single lines, wider ones as two triangles with a one pixel gap.
+    void placeBar(size_t index) {
+        sf::Vertex* v = &bars[index * verticesPerBar];
+        float left = index * barWidth;
+        float top = 600.0f - engine.arr[index] * valueScale;
+        if (verticesPerBar == 2) {
+            v[0].position = sf::Vector2f(left + 0.5f, 600.0f);
+            v[1].position = sf::Vector2f(left + 0.5f, top);
+        } else {
+            float right = left + barWidth - 1;
+            v[0].position = sf::Vector2f(left, top);
+            v[1].position = sf::Vector2f(right, top);
+            v[2].position = sf::Vector2f(right, 600.0f);
+            v[3].position = sf::Vector2f(left, top);
+            v[4].position = sf::Vector2f(right, 600.0f);
+            v[5].position = sf::Vector2f(left, 600.0f);
+        }
+    }
+
+    void updateBar(size_t index, int value) {
+        if (index < engine.arr.size()) {
+            engine.arr[index] = value;
+            if (lod) {
+                columns.update(index, value);
+            } else {
+                placeBar(index);
+            }
+        }
+    }
+
+    void placeAllBars() {
+        if (lod) {
+            columns.reset(engine.arr, lodColumns, 401, valueScale);
+            return;
+        }
+        for (size_t i = 0; i < engine.arr.size(); ++i) {
+            placeBar(i);
+        }
+    }
+
+    // Colors every bar, or sets the base of the heatmap and lets it go cold.
+    void paintBars(sf::Color color) {
+        if (lod) {
+            lodBase = color;
+            columns.cool(0.0f);
+            return;
+        }
+        for (size_t i = 0; i < bars.getVertexCount(); ++i) {
+            bars[i].color = color;
+        }
+    }
+
+    void layoutBars() {
+        size_t size = engine.arr.size();
+        lod = size > lodColumns;
+        barWidth = 800.0f / size;
+        verticesPerBar = lod ? 4 : (barWidth >= 2.0f ? 6 : 2);
+        bars.setPrimitiveType(verticesPerBar == 6 ? sf::Triangles : sf::Lines);
+        bars.resize((lod ? lodColumns : size) * verticesPerBar);
+        highlightFrame.assign(lod ? 0 : size, 0);
+        barOwner.assign(lod ? 0 : size, 0);
+        placeAllBars();
+        paintBars(sf::Color(75, 156, 234)); // Blue
+    }
+
+    // Heat of a column relative to the hottest one, from the base color through red to yellow.
+    sf::Color heatColor(float heat, float hottest) const {
+        if (heat < 0.5f) return lodBase;
+        float t = std::log1p(heat) / std::log1p(std::max(hottest, 1.0f));
+        auto mix = [](sf::Color a, sf::Color b, float f) {
+            return sf::Color(static_cast<sf::Uint8>(a.r + (b.r - a.r) * f), static_cast<sf::Uint8>(a.g + (b.g - a.g) * f),
+                             static_cast<sf::Uint8>(a.b + (b.b - a.b) * f));
+        };
+        return t < 0.5f ? mix(lodBase, sf::Color(255, 85, 85), t * 2) : mix(sf::Color(255, 85, 85), sf::Color(255, 255, 85), t * 2 - 1);
+    }
+
+    // Rebuilds the per-column geometry once per frame: a line up to the column's mean in its heat
+    // color, and a translucent band from its lowest to its highest element on top.
+    void placeColumns() {
+        float hottest = 0;
+        for (size_t c = 0; c < lodColumns; ++c) {
+            hottest = std::max(hottest, columns.heatOf(c));
+        }
+        for (size_t c = 0; c < lodColumns; ++c) {
+            auto [low, high] = columns.envelope(c);
+            float x = c + 0.5f;
+            sf::Vertex* v = &bars[c * 4];
+            sf::Color color = heatColor(columns.heatOf(c), hottest);
+            v[0] = sf::Vertex(sf::Vector2f(x, 600.0f), color);
+            v[1] = sf::Vertex(sf::Vector2f(x, 600.0f - columns.meanRow(c)), color);
+            v[2] = sf::Vertex(sf::Vector2f(x, 600.0f - low), sf::Color(255, 255, 255, 90));
+            v[3] = sf::Vertex(sf::Vector2f(x, 600.0f - high - 1), sf::Color(255, 255, 255, 90));
+        }
+        columns.cool(heatDecay);
+    }
+
+    static std::string formatRate(double rate) {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(rate >= 1e3 ? 1 : 0);
+        if (rate >= 1e9) {
+            ss << rate / 1e9 << "G";
+        } else if (rate >= 1e6) {
+            ss << rate / 1e6 << "M";
+        } else if (rate >= 1e3) {
+            ss << rate / 1e3 << "k";
+        } else {
+            ss << rate;
+        }
+        return ss.str();
+    }
+
+    std::string counterText(PerfCounters::Event event) const {
+        return runCounters.valid[event] ? formatRate(double(runCounters.values[event])) : "-";
+    }
+
+    // Counters change on nearly every step, so callers only mark the panel and draw() formats it
+    // once per frame.
+    void updateStats() { statsDirty = true; }
+
+    void formatStats() {
+        std::stringstream ss;
+        if (!lanes.empty()) {
+            ss << "Race: " << raceFinished.load() << " / " << lanes.size() << " finished" << (racePaused ? ", paused" : "")
+               << "\nSpeed: " << formatRate(opsPerSecond) << " ops/sec per lane\nInput: " << distributions[distributionIndex].name;
+        } else if (external) {
+            size_t runs = external->runLengths.size();
+            uint64_t total = std::max<uint64_t>(external->totalKeys, 1);
+            ss << "Runs: " << external->runsFormed.load() << " / " << runs << "\nMerged: " << std::fixed << std::setprecision(1)
+               << (runs > 1 ? 100.0 * external->keysWritten.load() / total : 0.0) << "%\nKeys: " << formatRate(double(external->totalKeys));
+        } else if (isReplaying) {
+            ss << "Comparisons: " << replay.comparisons << "\nSwaps: " << replay.swaps << "\nSpeed: " << (replayDirection < 0 ? "-" : "") << formatRate(opsPerSecond) << " ops/sec"
+               << "\nStep: " << replay.position() << " / " << replay.stepCount();
+        } else {
+            ss << "Comparisons: " << engine.comparisons << "\nSwaps: " << engine.swaps << "\nSpeed: " << formatRate(opsPerSecond) << " ops/sec"
+               << "\nInput: " << distributions[distributionIndex].name;
+            if (runCounters.any()) {
+                ss << "\nCycles: " << counterText(PerfCounters::Cycles) << ", IPC " << std::fixed << std::setprecision(2)
+                   << (runCounters.values[PerfCounters::Cycles] ? double(runCounters.values[PerfCounters::Instructions]) / runCounters.values[PerfCounters::Cycles] : 0.0)
+                   << "\nL1d/LLC miss: " << counterText(PerfCounters::L1dMisses) << " / " << counterText(PerfCounters::LlcMisses)
+                   << "\nBranch miss: " << counterText(PerfCounters::BranchMisses);
+            } else if (!processCounters().available()) {
+                ss << "\nCounters: " << processCounters().status();
+            }
+            if (cache) {
+                for (const auto& level : cache->levels()) {
+                    uint64_t total = std::max<uint64_t>(level.hits + level.misses, 1);
+                    ss << "\n" << level.name << ": " << std::fixed << std::setprecision(1) << 100.0 * level.hits / total << "% hit, "
+                       << formatRate(double(level.misses)) << " miss";
+                }
+            }
+        }
+        statsDirty = false;
+        std::string text = ss.str();
+        if (text != shownStats) {
+            shownStats = std::move(text);
+            statsText.setString(shownStats);
+            statsPanel.setSize(sf::Vector2f(190, std::max(145.0f, statsText.getLocalBounds().height + 30)));
+        }
+    }
+
+    float advanceOf(char c) const {
+        unsigned char u = static_cast<unsigned char>(c);
+        return u < glyphAdvance.size() ? glyphAdvance[u] : font.getGlyph(u, 16, true).advance;
+    }
+
+    float widthOf(std::string_view word) const {
+        float width = 0;
+        for (char c : word) width += advanceOf(c);
+        return width;
+    }
+
+    // Greedy word wrap from the cached glyph advances, linear in the length of the paragraph.
+    // Words wider than a whole line are broken between characters.
+    std::string wrapParagraph(std::string_view paragraph, float maxWidth) const {
+        std::string wrapped;
+        float lineWidth = 0, space = advanceOf(' ');
+        size_t start = 0;
+        while (start <= paragraph.size()) {
+            size_t end = std::min(paragraph.find(' ', start), paragraph.size());
+            std::string_view word = paragraph.substr(start, end - start);
+            float width = widthOf(word);
+            if (lineWidth > 0 && lineWidth + space + width > maxWidth) {
+                wrapped += '\n';
+                lineWidth = 0;
+            } else if (start > 0) {
+                wrapped += ' ';
+                lineWidth += space;
+            }
+            for (char c : word) {
+                float advance = advanceOf(c);
+                if (lineWidth > 0 && lineWidth + advance > maxWidth) {
+                    wrapped += '\n';
+                    lineWidth = 0;
+                }
+                wrapped += c;
+                lineWidth += advance;
+            }
+            start = end + 1;
+        }
+        return wrapped;
+    }
+
+    // Wraps each line of text separately and remembers the result, so redrawing the same details
+    // (e.g. on every pause toggle) costs a lookup per line.
+    std::string wrapText(const std::string& text, float maxWidth) {
+        if (wrappedParagraphs.size() > 256) wrappedParagraphs.clear();
+        std::string wrapped;
+        size_t start = 0;
+        while (start <= text.size()) {
+            size_t end = std::min(text.find('\n', start), text.size());
+            std::string paragraph = text.substr(start, end - start);
+            auto it = wrappedParagraphs.find(paragraph);
+            if (it == wrappedParagraphs.end()) {
+                it = wrappedParagraphs.emplace(paragraph, wrapParagraph(paragraph, maxWidth)).first;
+            }
+            if (start > 0) wrapped += '\n';
+            wrapped += it->second;
+            start = end + 1;
+        }
+        return wrapped;
+    }
+
+    // Distinct tint per worker, stepping the hue by the golden ratio so neighbours differ.
+    static sf::Color workerColor(unsigned worker) {
+        float hue = std::fmod(worker * 0.618034f, 1.0f) * 6.0f;
+        float s = 0.55f, v = 0.95f;
+        float c = v * s, x = c * (1 - std::fabs(std::fmod(hue, 2.0f) - 1)), m = v - c;
+        float r = 0, g = 0, b = 0;
+        switch (static_cast<int>(hue)) {
+            case 0: r = c; g = x; break;
+            case 1: r = x; g = c; break;
+            case 2: g = c; b = x; break;
+            case 3: g = x; b = c; break;
+            case 4: r = x; b = c; break;
+            default: r = c; b = x; break;
+        }
+        return sf::Color(static_cast<sf::Uint8>((r + m) * 255), static_cast<sf::Uint8>((g + m) * 255), static_cast<sf::Uint8>((b + m) * 255));
+    }
+
+    sf::Color baseColor(size_t index) const {
+        return barOwner[index] ? workerColor(barOwner[index]) : sf::Color(75, 156, 234);
+    }
+
+    // Starts a new frame of highlights: bars touched in the previous frame go back to their
+    // base color (blue, or the tint of the worker that last wrote them).
+    void clearHighlights() {
+        for (size_t index : highlighted) {
+            setBarColor(index, baseColor(index));
+        }
+        highlighted.clear();
+        ++frameNumber;
+    }
+
+    void highlight(size_t index, sf::Color color) {
+        if (index >= engine.arr.size()) return;
+        if (lod) {
+            columns.touch(index);
+            return;
+        }
+        setBarColor(index, color);
+        if (highlightFrame[index] != frameNumber) {
+            highlightFrame[index] = frameNumber;
+            highlighted.push_back(index);
+        }
+    }
+
+    // With the cache simulator on, a touched bar shows where its access was served: green for
+    // L1, yellow for L2, orange for any later level and red for memory.
+    sf::Color accessColor(const SortStep& step, int which, sf::Color plain) const {
+        unsigned level = step.cacheLevel[which];
+        if (!level || !cache) return plain;
+        if (level > cache->levels().size()) return sf::Color(255, 85, 85);
+        static const sf::Color levelColors[] = {sf::Color(85, 255, 85), sf::Color(255, 255, 85), sf::Color(255, 170, 60)};
+        return levelColors[std::min<unsigned>(level, 3) - 1];
+    }
+
+    // Mirrors a step the engine has already applied to arr onto the bars. Highlights accumulate
+    // until the next clearHighlights(), so a frame shows every bar its steps touched.
+    void applyStep(const SortStep& step) {
+        if (!lod && step.worker && (step.type == StepType::Swap || step.type == StepType::Write)) {
+            barOwner[step.first] = step.worker;
+            barOwner[step.second] = step.worker;
+        }
+        switch (step.type) {
+            case StepType::Compare:
+            case StepType::Read:
+                highlight(step.first, accessColor(step, 0, sf::Color(255, 85, 85)));
+                highlight(step.second, accessColor(step, 1, sf::Color(255, 85, 85)));
+                break;
+            case StepType::Swap:
+                updateBar(step.first, engine.arr[step.first]);
+                updateBar(step.second, engine.arr[step.second]);
+                highlight(step.first, accessColor(step, 0, sf::Color(255, 85, 85)));
+                highlight(step.second, accessColor(step, 1, sf::Color(255, 85, 85)));
+                break;
+            case StepType::Write:
+                updateBar(step.first, engine.arr[step.first]);
+                highlight(step.first, accessColor(step, 0, sf::Color(85, 255, 85)));
+                break;
+            case StepType::Pivot:
+                markedIndex = step.first;
+                break;
+            case StepType::Run:
+                // Runs keep their own tint until a merge re-tints the combined range.
+                ++runsShown;
+                for (size_t i = step.first; i <= step.second && i < barOwner.size(); ++i) {
+                    barOwner[i] = runsShown % 6 + 1;
+                    if (highlightFrame[i] != frameNumber) setBarColor(i, baseColor(i));
+                }
+                break;
+        }
+        if (!lod && markedIndex < engine.arr.size()) { // A pivot would swamp the heatmap
+            highlight(markedIndex, sf::Color(255, 255, 85));
+        }
+    }
+
+    // Pulls one step from the running algorithm, or from the trace in the current playback
+    // direction. Returns false once the algorithm has finished or the trace hits either end.
+    bool stepOnce() {
+        if (isReplaying) {
+            SortStep step;
+            bool moved = replayDirection > 0 ? replay.stepForward(engine.arr, step) : replay.stepBackward(engine.arr, step);
+            if (!moved) {
+                isPaused = true;
+                updateDetails(currentDetails);
+                return false;
+            }
+            applyStep(step);
+            return true;
+        }
+        bool more = false;
+        try {
+            more = task.next();
+        } catch (const std::exception& e) {
+            finishSort(e.what());
+            return false;
+        }
+        if (!more) {
+            finishSort();
+            return false;
+        }
+        applyStep(task.step());
+        return true;
+    }
 
-    void setBarColor(size_t index, sf::Color color) {
-        if (index < bars.size()) {
-            bars[index].setFillColor(color);
+    // Ends the run; `failure` is the error that stopped the algorithm, if any.
+    void finishSort(const std::string& failure = {}) {
+        task.reset();
+        isSorting = false;
+        isPaused = false;
+        markedIndex = -1;
+        clearHighlights();
+        resetColors();
+        updateStats();
+        if (!failure.empty()) {
+            currentDetails += "\nSort failed: " + failure;
+        } else if (!selectionInput.empty()) {
+            // A full Quick Sort of the same input, run unobserved once the selection is done.
+            SortEngine full;
+            full.arr = std::move(selectionInput);
+            runAlgorithm(full, *findAlgorithm("quick")).run();
+            auto share = [](unsigned long long part, unsigned long long whole) { return std::to_string(whole ? part * 100 / whole : 100) + "%"; };
+            currentDetails += "\nDone with " + share(engine.comparisons, full.comparisons) + " of the comparisons and " + share(engine.swaps, full.swaps) +
+                              " of the swaps of a full Quick Sort (" + std::to_string(full.comparisons) + " and " + std::to_string(full.swaps) + ").";
         }
+        selectionInput.clear();
+        updateDetails(currentDetails);
     }
 
-    void updateBar(size_t index, int value) {
-        if (index < bars.size()) {
-            arr[index] = value;
-            bars[index].setSize(sf::Vector2f(barWidth - 1, value));
-            bars[index].setPosition(index * barWidth, 600 - value);
+    // The K key steps k through the median, n / 10, n / 100 and 1.
+    size_t nextSelectCount() {
+        selectChoice = (selectChoice + 1) % 4;
+        const size_t n = engine.arr.size();
+        const size_t choices[] = {0, n / 10, n / 100, 1};
+        return choices[selectChoice];
+    }
+
+    std::string describeSelectCount() const {
+        return "k = " + std::to_string(engine.selectionSize()) + " of " + std::to_string(engine.arr.size()) + (engine.selectCount ? "" : " (the median)");
+    }
+
+    // Lane thread body. An exception escaping the thread would terminate the whole app, so an
+    // algorithm that throws only marks its own lane as failed.
+    void runLane(RaceLane& lane) {
+        try {
+            stepLane(lane);
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(lane.mutex);
+            lane.snapshot = lane.engine.arr;
+            lane.lastStep = SortStep{};
+            lane.failure = e.what();
         }
     }
 
-    void updateStats() {
-        std::stringstream ss;
-        ss << "Comparisons: " << comparisons << "\nSwaps: " << swaps << "\nSpeed: " << (1000.0 / delayMs) << " ops/sec";
-        statsText.setString(ss.str());
+    // Steps the sort at the shared target speed, like advance() does for the single view, and
+    // publishes a snapshot after every slice.
+    void stepLane(RaceLane& lane) {
+        SortTask laneTask = runAlgorithm(lane.engine, *lane.info);
+        auto last = std::chrono::steady_clock::now();
+        double pending = 0, elapsedMs = 0;
+        bool done = false;
+        while (!done && !raceStopping) {
+            auto now = std::chrono::steady_clock::now();
+            if (racePaused) {
+                last = now;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            double seconds = std::chrono::duration<double>(now - last).count();
+            elapsedMs += seconds * 1000;
+            pending += seconds * raceSpeed.load();
+            last = now;
+            auto deadline = now + std::chrono::duration<float, std::milli>(frameBudgetMs);
+            unsigned long long due = static_cast<unsigned long long>(pending);
+            pending -= due;
+            for (unsigned long long i = 0; i < due; ++i) {
+                if (!laneTask.next()) {
+                    done = true;
+                    break;
+                }
+                if ((i & 255) == 255 && std::chrono::steady_clock::now() >= deadline) {
+                    pending = 0;
+                    break;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(lane.mutex);
+                lane.snapshot = lane.engine.arr;
+                lane.lastStep = done ? SortStep{} : laneTask.step();
+                lane.elapsedMs = elapsedMs;
+                if (done) lane.place = ++raceFinished;
+            }
+            if (!done) std::this_thread::sleep_until(now + std::chrono::milliseconds(16));
+        }
     }
 
-    std::string wrapText(const std::string& text, float maxWidth) {
-        std::string wrapped;
-        std::string currentLine;
-        size_t lastSpace = 0;
-        float currentWidth = 0;
-        sf::Text tempText("", font, 16);
-        for (size_t i = 0; i < text.length(); ++i) {
-            currentLine += text[i];
-            tempText.setString(currentLine);
-            currentWidth = tempText.getGlobalBounds().width;
-            if (text[i] == ' ' || text[i] == '\n') {
-                lastSpace = i;
-            }
-            if (currentWidth > maxWidth || text[i] == '\n') {
-                if (lastSpace > 0 && text[i] != '\n') {
-                    wrapped += currentLine.substr(0, lastSpace) + "\n";
-                    currentLine = currentLine.substr(lastSpace + 1);
-                    i = lastSpace;
+    void stopRace() {
+        raceStopping = true;
+        for (auto& lane : lanes) {
+            if (lane->thread.joinable()) lane->thread.join();
+        }
+        lanes.clear();
+        raceLabels.clear();
+        updateStats();
+        updateDetails("Race stopped. Select an algorithm, or press C to race again.");
+    }
+
+    // Builds every lane's bars in its own viewport of a grid below the control panel, with its
+    // counters, elapsed time and finish position above the bars.
+    void updateRace() {
+        size_t count = lanes.size();
+        size_t columns = static_cast<size_t>(std::ceil(std::sqrt(double(count))));
+        size_t rows = (count + columns - 1) / columns;
+        float cellWidth = 800.0f / columns, cellHeight = 400.0f / rows;
+        size_t n = engine.arr.size();
+        float barWidth = (cellWidth - 10) / std::max<size_t>(n, 1);
+        bool lines = barWidth < 2.0f;
+        size_t perBar = lines ? 2 : 6;
+        raceBars.setPrimitiveType(lines ? sf::Lines : sf::Triangles);
+        raceBars.resize(count * n * perBar);
+        raceLabels.resize(count);
+        for (size_t l = 0; l < count; ++l) {
+            RaceLane& lane = *lanes[l];
+            float left = (l % columns) * cellWidth + 5, bottom = 200.0f + (l / columns + 1) * cellHeight - 2;
+            float scale = std::max(cellHeight - 40, 1.0f) / 400.0f; // Values go up to 400
+            std::lock_guard<std::mutex> lock(lane.mutex);
+            bool failed = !lane.failure.empty();
+            sf::Color base = failed ? sf::Color(128, 128, 128) : lane.place ? sf::Color(85, 255, 85) : sf::Color(75, 156, 234);
+            for (size_t i = 0; i < n; ++i) {
+                bool touched = !lane.place && !failed && (i == lane.lastStep.first || i == lane.lastStep.second);
+                sf::Color color = touched ? sf::Color(255, 85, 85) : base;
+                float x = left + i * barWidth, top = bottom - std::min(lane.snapshot[i] * scale, cellHeight - 40);
+                sf::Vertex* v = &raceBars[(l * n + i) * perBar];
+                if (lines) {
+                    v[0] = sf::Vertex(sf::Vector2f(x + 0.5f, bottom), color);
+                    v[1] = sf::Vertex(sf::Vector2f(x + 0.5f, top), color);
                 } else {
-                    wrapped += currentLine + "\n";
-                    currentLine = "";
+                    float right = x + barWidth - 1;
+                    v[0] = sf::Vertex(sf::Vector2f(x, top), color);
+                    v[1] = sf::Vertex(sf::Vector2f(right, top), color);
+                    v[2] = sf::Vertex(sf::Vector2f(right, bottom), color);
+                    v[3] = sf::Vertex(sf::Vector2f(x, top), color);
+                    v[4] = sf::Vertex(sf::Vector2f(right, bottom), color);
+                    v[5] = sf::Vertex(sf::Vector2f(x, bottom), color);
                 }
-                lastSpace = 0;
-                tempText.setString(currentLine);
-                currentWidth = tempText.getGlobalBounds().width;
             }
+            std::stringstream ss;
+            if (lane.place) ss << "#" << lane.place << " ";
+            ss << lane.info->name << "  " << std::fixed << std::setprecision(2) << lane.elapsedMs / 1000 << " s\n";
+            if (failed) {
+                ss << "Failed: " << lane.failure;
+            } else {
+                ss << formatRate(double(lane.engine.comparisons)) << " cmp, " << formatRate(double(lane.engine.swaps)) << " swaps";
+            }
+            sf::Text& label = raceLabels[l];
+            label.setFont(font);
+            label.setCharacterSize(12);
+            label.setFillColor(failed ? sf::Color(255, 85, 85) : lane.place == 1 ? sf::Color(255, 255, 85) : sf::Color::White);
+            label.setPosition(left, bottom - cellHeight + 4);
+            label.setString(ss.str());
         }
-        wrapped += currentLine;
-        return wrapped;
+        updateStats();
     }
 
-public:
-    SortingVisualizer(sf::RenderWindow& win, int size = 100, int delay = 5)
-        : window(win), delayMs(delay), isSorting(false), isPaused(false), currentAlgorithm("None"), comparisons(0), swaps(0), activeAlgorithmIndex(-1) {
-        arr.resize(size);
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(10, 400);
-        for (int i = 0; i < size; ++i) {
-            arr[i] = dis(gen);
+    void seekReplay(uint64_t target) {
+        replay.seek(target, engine.arr);
+        std::fill(barOwner.begin(), barOwner.end(), 0);
+        clearHighlights();
+        markedIndex = -1;
+        placeAllBars();
+        resetColors();
+        pendingSteps = 0;
+        updateStats();
+    }
+
+    void handleReplayKey(sf::Keyboard::Key key) {
+        uint64_t jump = std::max<uint64_t>(replay.stepCount() / 20, 1);
+        switch (key) {
+            case sf::Keyboard::B:
+                replayDirection = -replayDirection;
+                break;
+            case sf::Keyboard::Left:
+            case sf::Keyboard::Right:
+                isPaused = true;
+                replayDirection = key == sf::Keyboard::Right ? 1 : -1;
+                clearHighlights();
+                stepOnce();
+                break;
+            case sf::Keyboard::PageUp: seekReplay(replay.position() - std::min(jump, replay.position())); break;
+            case sf::Keyboard::PageDown: seekReplay(replay.position() + jump); break;
+            case sf::Keyboard::Home: seekReplay(0); break;
+            case sf::Keyboard::End: seekReplay(replay.stepCount()); break;
+            default: break;
         }
+        updateDetails(currentDetails);
+        updateStats();
+    }
 
-        barWidth = 800.0f / size;
-        bars.resize(size);
-        for (size_t i = 0; i < size; ++i) {
-            bars[i].setSize(sf::Vector2f(barWidth - 1, arr[i]));
-            bars[i].setPosition(i * barWidth, 600 - arr[i]);
-            bars[i].setFillColor(sf::Color(75, 156, 234)); // Blue
+public:
+    void startAlgorithm(size_t index) {
+        std::string reasoning;
+        if (algorithms[index].automatic) {
+            InputProfile profile = profileInput(engine.arr, engine.keyOf, engine.less);
+            AutoChoice choice = chooseAlgorithm(profile);
+            reasoning = describeChoice(profile, choice) + "\n\n";
+            index = choice.algorithm - algorithms.data();
+        }
+        const AlgorithmInfo& info = algorithms[index];
+        task.reset();
+        clearHighlights();
+        markedIndex = -1;
+        isSorting = true;
+        isPaused = false;
+        currentAlgorithm = reasoning.empty() ? info.name : std::string("Auto, running ") + info.name;
+        activeAlgorithmIndex = index;
+        engine.resetCounters();
+        runCounters = PerfCounters::Sample();
+        if (cache) cache->clear();
+        std::fill(barOwner.begin(), barOwner.end(), 0);
+        resetColors();
+        std::string details = reasoning + info.details;
+        if (info.parallel) {
+            details += "\nWorkers: " + std::to_string(engine.threadPool().size());
+        }
+        selectionInput.clear();
+        if (info.output != SortOutput::Sorted) {
+            // Kept so finishSort can compare with a full sort without delaying the first frame.
+            selectionInput = engine.arr;
+            details += "\n" + describeSelectCount() + ".";
         }
+        updateDetails(details);
+        pendingSteps = 0;
+        lastAdvance = std::chrono::steady_clock::now();
+        task = runAlgorithm(engine, info);
+    }
+
+    SortingVisualizer(sf::RenderTarget& surface, int size = 100, double speed = 256, uint64_t seed = 42)
+        : target(surface), window(dynamic_cast<sf::RenderWindow*>(&surface)), isReplaying(false), replayDirection(1), frameNumber(1), markedIndex(-1), valueScale(1.0f), opsPerSecond(speed), pendingSteps(0), isSorting(false), isPaused(false), currentAlgorithm("None"), activeAlgorithmIndex(-1) {
+        engine.observed = true;
+        generator.seed = seed;
+        generator.low = 10;
+        generator.high = 400;
+        generator.fill(engine.arr, size);
+        layoutBars();
 
         if (!font.loadFromFile("/usr/share/fonts/dejavu-sans-fonts/DejaVuSans.ttf")) {
             detailsText.setString("Font failed to load. Algorithm: None");
@@ -108,7 +4479,7 @@ public:
             instructionsText.setFillColor(sf::Color::White);
             instructionsText.setStyle(sf::Text::Bold);
             instructionsText.setPosition(10, 5);
-            instructionsText.setString("Keys 1-0: Select algorithm, R: Reset, P: Pause/Resume, +/-: Speed");
+            instructionsText.setString("Keys 1-0, F1-F8: Algorithm, K: k, C: Race, M: Cache sim, R: Reset, D: Input, P: Pause, N: Step, +/-: Speed");
 
             // Stats
             statsText.setFont(font);
@@ -118,7 +4489,7 @@ public:
             updateStats();
 
             // Stats panel
-            statsPanel.setSize(sf::Vector2f(180, 80));
+            statsPanel.setSize(sf::Vector2f(190, 145));
             statsPanel.setPosition(590, 90);
             statsPanel.setFillColor(sf::Color(50, 50, 50, 200));
 
@@ -128,6 +4499,9 @@ public:
             detailsText.setFillColor(sf::Color::White);
             detailsText.setStyle(sf::Text::Bold);
             detailsText.setPosition(10, 100);
+            for (unsigned c = 0; c < glyphAdvance.size(); ++c) {
+                glyphAdvance[c] = font.getGlyph(c, 16, true).advance;
+            }
             updateDetails("Select an algorithm by clicking or using keys 1-0.");
 
             // Control panel
@@ -138,7 +4512,9 @@ public:
             // Algorithm buttons
             std::vector<std::string> algoNames = {
                 "1: Bubble", "2: Selection", "3: Insertion", "4: Quick", "5: Merge",
-                "6: Heap", "7: Tim", "8: Counting", "9: Radix", "0: Bucket"
+                "6: Heap", "7: Tim", "8: Counting", "9: Radix", "0: Bucket",
+                "F1: P-Merge", "F2: P-Quick", "F3: Bitonic", "F4: P-Sample", "F5: Select",
+                "F6: Top-k", "F7: Partial", "F8: Auto"
             };
             float x = 20, y = 35;
             for (const auto& name : algoNames) {
@@ -158,572 +4534,1738 @@ public:
         }
     }
 
+    ~SortingVisualizer() {
+        raceStopping = true;
+        for (auto& lane : lanes) {
+            if (lane->thread.joinable()) lane->thread.join();
+        }
+    }
+
+    // Switches to playing back a recorded trace. Algorithm selection is disabled while replaying.
+    bool openReplay(const std::string& path, std::string& error) {
+        if (!replay.open(path, error)) return false;
+        task.reset();
+        isReplaying = true;
+        isSorting = true;
+        isPaused = true;
+        replayDirection = 1;
+        replay.seek(0, engine.arr);
+        int maxVal = engine.arr.empty() ? 0 : *std::max_element(engine.arr.begin(), engine.arr.end());
+        valueScale = maxVal > 400 ? 400.0f / maxVal : 1.0f;
+        highlighted.clear();
+        markedIndex = -1;
+        layoutBars();
+        currentAlgorithm = "Replay of " + replay.algorithm();
+        instructionsText.setString("P: Play/Pause, B: Reverse, Left/Right: Step, PgUp/PgDn/Home/End/Click: Seek, +/-: Speed");
+        updateDetails(std::to_string(replay.elementCount()) + " elements, " + std::to_string(replay.stepCount()) + " steps recorded.");
+        updateStats();
+        return true;
+    }
+
+    // Runs the steps due at the target ops/sec since the last frame, then returns so the frame
+    // is rendered once. If they don't fit in the frame budget the rest are dropped rather than
+    // carried over, so a slow machine runs below target speed instead of falling behind.
+    void advance() {
+        auto now = std::chrono::steady_clock::now();
+        if (!isSorting || isPaused) {
+            lastAdvance = now;
+            return;
+        }
+        pendingSteps += std::chrono::duration<double>(now - lastAdvance).count() * opsPerSecond;
+        lastAdvance = now;
+        if (pendingSteps < 1.0) return;
+        clearHighlights();
+        auto deadline = now + std::chrono::duration<float, std::milli>(frameBudgetMs);
+        unsigned long long due = static_cast<unsigned long long>(pendingSteps);
+        pendingSteps -= due;
+        PerfCounters::Sample before = processCounters().read();
+        for (unsigned long long i = 0; i < due; ++i) {
+            if (!stepOnce()) break;
+            if ((i & 255) == 255 && std::chrono::steady_clock::now() >= deadline) {
+                pendingSteps = 0;
+                break;
+            }
+        }
+        if (!isReplaying) runCounters += processCounters().read() - before;
+        updateStats();
+    }
+
+    // Applies the next `steps` steps however long they take, for a frame of an export. Returns
+    // false once the sort has finished and its last frame was already shown.
+    bool advanceBy(unsigned long long steps) {
+        if (!isSorting) return false;
+        clearHighlights();
+        PerfCounters::Sample before = processCounters().read();
+        for (unsigned long long i = 0; i < steps && stepOnce(); ++i) {
+        }
+        runCounters += processCounters().read() - before;
+        updateStats();
+        return true;
+    }
+
+    // Rebuilds the run segments: each run spans a width proportional to its length, grey until
+    // it has been formed, then in its own tint with a height showing what is left to merge.
+    void updateExternal() {
+        const ExternalProgress& progress = *external;
+        size_t runs = progress.runLengths.size();
+        size_t formed = progress.runsFormed.load();
+        int phase = progress.phase.load();
+        runBars.setPrimitiveType(sf::Triangles);
+        runBars.resize(runs * 12);
+        double total = std::max<double>(double(progress.totalKeys), 1);
+        double start = 0;
+        for (size_t r = 0; r < runs; ++r) {
+            double length = double(progress.runLengths[r]);
+            float left = float(start / total * 800), right = std::max(left + 1, float((start + length) / total * 800) - 1);
+            start += length;
+            double remaining = r < formed ? 1.0 - progress.runsMerged[r].load() / std::max(length, 1.0) : 1.0;
+            if (phase == ExternalProgress::Done && runs > 1) remaining = 0;
+            float top = 600.0f - float(remaining * 400), floor = 600.0f;
+            sf::Color color = r < formed ? workerColor(static_cast<unsigned>(r) + 1) : sf::Color(90, 90, 90);
+            sf::Color merged(70, 70, 70);
+            sf::Vertex* v = &runBars[r * 12];
+            sf::Vector2f quads[2][4] = {
+                {{left, 200.0f}, {right, 200.0f}, {right, top}, {left, top}}, // Already merged
+                {{left, top}, {right, top}, {right, floor}, {left, floor}}, // Still to merge
+            };
+            for (int q = 0; q < 2; ++q) {
+                const sf::Vector2f* c = quads[q];
+                sf::Vector2f corners[6] = {c[0], c[1], c[2], c[0], c[2], c[3]};
+                for (int k = 0; k < 6; ++k) {
+                    v[q * 6 + k] = sf::Vertex(corners[k], q == 0 ? merged : color);
+                }
+            }
+        }
+        if (phase != externalPhase) {
+            externalPhase = phase;
+            static const char* phaseNames[] = {"Forming sorted runs", "Merging runs with a loser tree", "Done", "Failed"};
+            std::string details = std::string(phaseNames[phase]) + "\n" + std::to_string(runs) + " runs of up to " +
+                                  (runs ? std::to_string(progress.runLengths[0]) : std::string("0")) + " keys.";
+            if (phase == ExternalProgress::Failed) details += "\n" + progress.error;
+            updateDetails(details);
+        }
+        updateStats();
+    }
+
     void draw() {
-        window.clear(sf::Color(46, 46, 46)); // Dark gray
-        window.draw(controlPanel);
-        sf::Vector2i mousePos = sf::Mouse::getPosition(window);
+        if (external) updateExternal();
+        if (!lanes.empty()) updateRace();
+        target.clear(sf::Color(46, 46, 46)); // Dark gray
+        target.draw(controlPanel);
+        sf::Vector2i mousePos = window ? sf::Mouse::getPosition(*window) : sf::Vector2i(-1, -1);
         for (size_t i = 0; i < algorithmButtons.size(); ++i) {
             bool isHovered = algorithmButtons[i].getGlobalBounds().contains(static_cast<float>(mousePos.x), static_cast<float>(mousePos.y));
             algorithmButtons[i].setFillColor(i == activeAlgorithmIndex ? sf::Color(85, 255, 85) : (isHovered ? sf::Color(255, 255, 85) : sf::Color::White));
-            window.draw(algorithmButtons[i]);
+            target.draw(algorithmButtons[i]);
         }
-        window.draw(instructionsText);
-        window.draw(statsPanel);
-        window.draw(statsText);
+        target.draw(instructionsText);
+        if (statsDirty) formatStats();
+        target.draw(statsPanel);
+        target.draw(statsText);
         if (isPaused) {
             detailsText.setFillColor(sf::Color(255, 85, 85));
         } else {
-            detailsText.setFillColor(sf::Color::White);
-        }
-        window.draw(detailsText);
-        for (const auto& bar : bars) {
-            window.draw(bar);
+            detailsText.setFillColor(sf::Color::White);
+        }
+        target.draw(detailsText);
+        if (!lanes.empty()) {
+            target.draw(raceBars);
+            for (const auto& label : raceLabels) {
+                target.draw(label);
+            }
+        } else if (external) {
+            target.draw(runBars);
+        } else {
+            if (lod) placeColumns();
+            target.draw(bars);
+        }
+        if (window) window->display();
+    }
+
+    void updateDetails(const std::string& details) {
+        currentDetails = details;
+        algorithmDetails = wrapText("Algorithm: " + currentAlgorithm + (isPaused ? "\nPaused" : "") + "\n" + details, 780);
+        detailsText.setString(algorithmDetails);
+    }
+
+    void resetColors() {
+        paintBars(isSorting ? sf::Color(75, 156, 234) : sf::Color(85, 255, 85)); // Green when sorted
+    }
+
+    // Regenerates the array from the current distribution and seed.
+    void resetArray() {
+        task.reset();
+        isSorting = false;
+        isPaused = false;
+        clearHighlights();
+        markedIndex = -1;
+        generator.distribution = distributions[distributionIndex].kind;
+        generator.fill(engine.arr, engine.arr.size());
+        placeAllBars();
+        paintBars(sf::Color(75, 156, 234));
+        currentAlgorithm = "None";
+        activeAlgorithmIndex = -1;
+        engine.resetCounters();
+        runCounters = PerfCounters::Sample();
+        updateStats();
+        updateDetails("Input: " + std::string(distributions[distributionIndex].name) + ", seed " + std::to_string(generator.seed) +
+                      ". Select an algorithm by clicking or using keys 1-0.");
+    }
+
+    void handleMouseClick(sf::Vector2i mousePos) {
+        if (external || !lanes.empty()) return;
+        if (isReplaying) {
+            float fraction = std::clamp(mousePos.x / 800.0f, 0.0f, 1.0f);
+            seekReplay(static_cast<uint64_t>(fraction * replay.stepCount()));
+            return;
+        }
+        if (isSorting && !isPaused) return;
+        for (size_t i = 0; i < algorithmButtons.size(); ++i) {
+            if (algorithmButtons[i].getGlobalBounds().contains(static_cast<float>(mousePos.x), static_cast<float>(mousePos.y))) {
+                startAlgorithm(i);
+                break;
+            }
+        }
+    }
+
+    void handleKeyPress(sf::Keyboard::Key key) {
+        if (external) return;
+        bool speedKey = key == sf::Keyboard::Add || key == sf::Keyboard::Equal || key == sf::Keyboard::Subtract || key == sf::Keyboard::Hyphen;
+        if (!lanes.empty() && !speedKey) {
+            if (key == sf::Keyboard::P) {
+                racePaused = !racePaused;
+                updateStats();
+            } else {
+                stopRace();
+            }
+            return;
+        }
+        if (key == sf::Keyboard::P) {
+            if (isSorting) {
+                isPaused = !isPaused;
+                updateDetails(currentDetails);
+            }
+            return;
+        }
+        if (key == sf::Keyboard::N) {
+            if (isSorting && isPaused) {
+                clearHighlights();
+                stepOnce();
+                updateStats();
+            }
+            return;
+        }
+        if (key == sf::Keyboard::Add || key == sf::Keyboard::Equal) {
+            opsPerSecond = std::min(opsPerSecond * 2, maxOpsPerSecond);
+            raceSpeed = opsPerSecond;
+            updateStats();
+            return;
+        }
+        if (key == sf::Keyboard::Subtract || key == sf::Keyboard::Hyphen) {
+            opsPerSecond = std::max(opsPerSecond / 2, minOpsPerSecond);
+            raceSpeed = opsPerSecond;
+            updateStats();
+            return;
+        }
+        if (isReplaying) {
+            handleReplayKey(key);
+            return;
+        }
+        if (isSorting) {
+            task.reset();
+            isSorting = false;
+            isPaused = false;
+            activeAlgorithmIndex = -1;
+            markedIndex = -1;
+            clearHighlights();
+            resetColors();
+            updateDetails("Sorting stopped. Select an algorithm.");
+            return;
+        }
+        switch (key) {
+            case sf::Keyboard::Num1: startAlgorithm(0); break;
+            case sf::Keyboard::Num2: startAlgorithm(1); break;
+            case sf::Keyboard::Num3: startAlgorithm(2); break;
+            case sf::Keyboard::Num4: startAlgorithm(3); break;
+            case sf::Keyboard::Num5: startAlgorithm(4); break;
+            case sf::Keyboard::Num6: startAlgorithm(5); break;
+            case sf::Keyboard::Num7: startAlgorithm(6); break;
+            case sf::Keyboard::Num8: startAlgorithm(7); break;
+            case sf::Keyboard::Num9: startAlgorithm(8); break;
+            case sf::Keyboard::Num0: startAlgorithm(9); break;
+            case sf::Keyboard::F1: startAlgorithm(10); break;
+            case sf::Keyboard::F2: startAlgorithm(11); break;
+            case sf::Keyboard::F3: startAlgorithm(12); break;
+            case sf::Keyboard::F4: startAlgorithm(13); break;
+            case sf::Keyboard::F5: startAlgorithm(14); break;
+            case sf::Keyboard::F6: startAlgorithm(15); break;
+            case sf::Keyboard::F7: startAlgorithm(16); break;
+            case sf::Keyboard::F8: startAlgorithm(17); break;
+            case sf::Keyboard::K:
+                setSelectCount(nextSelectCount());
+                break;
+            case sf::Keyboard::R:
+                ++generator.seed;
+                resetArray();
+                break;
+            case sf::Keyboard::D:
+                distributionIndex = (distributionIndex + 1) % distributions.size();
+                resetArray();
+                break;
+            case sf::Keyboard::C: startRace(); break;
+            case sf::Keyboard::M: enableCacheSimulator(!cache); break;
+            default: break;
+        }
+    }
+
+    // Shows the run-level progress of an external sort in place of the array.
+    void watchExternal(const ExternalProgress& progress) {
+        task.reset();
+        external = &progress;
+        isSorting = false;
+        currentAlgorithm = "External sort, runs by " + progress.algorithm;
+        algorithmButtons.clear();
+        instructionsText.setString("One segment per run; its height is the part not merged yet. Close the window to cancel.");
+        externalPhase = -1;
+    }
+
+    // Races the algorithms in raceAlgorithms on copies of the current array, one thread each.
+    void startRace() {
+        task.reset();
+        isSorting = false;
+        isPaused = false;
+        clearHighlights();
+        raceStopping = false;
+        racePaused = false;
+        raceSpeed = opsPerSecond;
+        raceFinished = 0;
+        std::string names;
+        for (size_t index : raceAlgorithms) {
+            auto lane = std::make_unique<RaceLane>();
+            lane->info = &algorithms[index];
+            lane->engine.observed = true;
+            lane->engine.arr = engine.arr;
+            lane->engine.selectCount = engine.selectCount;
+            if (lane->info->parallel) {
+                lane->pool = std::make_unique<ThreadPool>();
+                lane->engine.pool = lane->pool.get();
+            }
+            lane->snapshot = engine.arr;
+            names += (names.empty() ? "" : " vs ") + std::string(lane->info->name);
+            lanes.push_back(std::move(lane));
+        }
+        for (auto& lane : lanes) {
+            RaceLane* state = lane.get();
+            lane->thread = std::thread([this, state] { runLane(*state); });
+        }
+        currentAlgorithm = "Race";
+        activeAlgorithmIndex = -1;
+        updateDetails(names + ". P pauses, +/- change the speed of every lane, any other key ends the race.");
+    }
+
+    void setCacheLevels(const std::vector<CacheSimulator::LevelConfig>& levels, unsigned line) {
+        if (!levels.empty()) cacheLevels = levels;
+        cacheLine = line;
+    }
+
+    void enableCacheSimulator(bool enable) {
+        engine.cache = nullptr;
+        cache.reset();
+        if (enable) {
+            cache = std::make_unique<CacheSimulator>(cacheLevels, cacheLine);
+            engine.cache = cache.get();
+        }
+        updateStats();
+        std::string names;
+        for (const auto& level : cacheLevels) {
+            std::string bytes = level.bytes >= (1 << 20) ? std::to_string(level.bytes >> 20) + "M" : std::to_string(level.bytes >> 10) + "K";
+            names += (names.empty() ? "" : ", ") + level.name + " " + bytes + " " + std::to_string(level.ways) + "-way";
+        }
+        updateDetails(enable ? "Cache simulator on: " + names + ", " + std::to_string(cacheLine) + "-byte lines.\nBars show where each access was served: "
+                               "green L1, yellow L2, orange a later level, red memory. Press M to switch it off."
+                             : "Cache simulator off.");
+    }
+
+    void setRaceAlgorithms(const std::vector<size_t>& indices) {
+        if (!indices.empty()) raceAlgorithms = indices;
+    }
+
+    // k for the selection algorithms; 0 (or anything above n) selects the median.
+    void setSelectCount(size_t count) {
+        engine.selectCount = count;
+        updateDetails(describeSelectCount() + " for Select, Top-k and Partial (K changes it).");
+    }
+
+    void selectDistribution(size_t index) {
+        distributionIndex = index;
+        resetArray();
+    }
+
+    bool isSortingNow() const { return isSorting; }
+    bool isPausedNow() const { return isPaused; }
+};
+
+// Counts every heap allocation in the process so the benchmark can report what a sort
+// allocates while it runs.
+std::atomic<unsigned long long> heapAllocations{0};
+
+// Kept out of line: GCC otherwise sees malloc/free paired with new/delete and warns.
+#ifdef __GNUC__
+#define SORTING_ALLOCATOR_NOINLINE __attribute__((noinline))
+#else
+#define SORTING_ALLOCATOR_NOINLINE
+#endif
+
+SORTING_ALLOCATOR_NOINLINE void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1)) return pointer;
+    throw std::bad_alloc();
+}
+
+SORTING_ALLOCATOR_NOINLINE void operator delete(void* pointer) noexcept { std::free(pointer); }
+SORTING_ALLOCATOR_NOINLINE void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+
+struct BenchConfig {
+    std::vector<size_t> sizes = {1000, 10000, 100000};
+    std::vector<size_t> algorithmIndices;
+    std::vector<size_t> raceIndices; // Algorithms to race in the window, from --race
+    int repetitions = 3;
+    unsigned seed = 42;
+    int maxValue = 1000000;
+    size_t quadraticLimit = 50000; // Larger runs of O(n^2) algorithms are skipped
+    std::vector<size_t> threadCounts = {std::max(1u, std::thread::hardware_concurrency())}; // Pool sizes for parallel algorithms
+    unsigned radixBits = 8;
+    unsigned heapArity = 2;
+    size_t selectCount = 0; // k for the selection algorithms; the median if 0
+    std::vector<size_t> distributionIndices; // Into `distributions`; uniform if empty
+    size_t swaps = 0; // For nearly sorted inputs; n/100 if 0
+    std::string keyType = "int32"; // int32, uint64, float or double
+    std::string layout = "direct"; // direct (bare keys), records or indirect
+    std::vector<CacheSimulator::LevelConfig> cacheLevels; // Simulated when non-empty, from --cache
+    unsigned cacheLine = 64;
+    bool json = false;
+    std::string outputPath;
+};
+
+struct BenchResult {
+    const AlgorithmInfo* algorithm;
+    const DistributionInfo* distribution;
+    const char* key;
+    const char* layout;
+    size_t size;
+    size_t selectCount; // k of a selection algorithm, 0 for full sorts
+    size_t threads;
+    int repetition;
+    unsigned seed;
+    InputProfile profile; // What the Auto selector sees of the input
+    double wallMs;
+    unsigned long long comparisons;
+    unsigned long long swaps;
+    unsigned long long allocations; // Heap allocations between creating the task and finishing it
+    PerfCounters::Sample counters; // Over the same span as wallMs
+    std::vector<std::pair<uint64_t, uint64_t>> cache; // Simulated hits and misses per level
+    bool sorted;
+};
+
+// Keys in [0, maxValue] from one of the distributions: integers for integral keys, reals
+// otherwise.
+template <typename Key = int>
+std::vector<Key> benchInput(const BenchConfig& config, const DistributionInfo& distribution, size_t size, unsigned seed) {
+    InputGenerator generator;
+    generator.distribution = distribution.kind;
+    generator.seed = seed;
+    generator.high = config.maxValue;
+    generator.swaps = config.swaps;
+    std::vector<Key> input;
+    generator.fill(input, size);
+    return input;
+}
+
+// A record as stored in a table: the sort key followed by its payload, 256 bytes in all.
+template <typename Key>
+struct SortRecord {
+    Key key;
+    unsigned char payload[256 - sizeof(Key)];
+};
+
+template <typename Key>
+struct RecordKey {
+    const Key& operator()(const SortRecord<Key>& record) const { return record.key; }
+};
+
+// Key of a record reached through its index, for sorting indices instead of the records.
+template <typename Key>
+struct IndexedKey {
+    const SortRecord<Key>* records = nullptr;
+    const Key& operator()(uint32_t index) const { return records[index].key; }
+};
+
+template <typename Key>
+std::vector<SortRecord<Key>> makeRecords(const std::vector<Key>& keys) {
+    std::vector<SortRecord<Key>> records(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        records[i].key = keys[i];
+        std::memset(records[i].payload, static_cast<int>(i), sizeof records[i].payload);
+    }
+    return records;
+}
+
+// Whether [first, last) has its k smallest elements in front with the k-th at position k - 1,
+// and, if `ordered`, the front sorted.
+template <class It, class Before>
+bool isSelected(It first, It last, size_t k, Before before, bool ordered) {
+    if (k == 0) return true;
+    It kth = first + (k - 1);
+    if (ordered && !std::is_sorted(first, kth + 1, before)) return false;
+    return std::none_of(first, kth, [&](const auto& value) { return before(*kth, value); }) &&
+           std::none_of(kth + 1, last, [&](const auto& value) { return before(value, *kth); });
+}
+
+// How the benchmark lays elements out for the engine. `load` refills engine.arr before a run,
+// `finish` is timed together with the sort and `sorted` checks the final order.
+template <typename Key>
+struct DirectLayout {
+    using Engine = BasicSortEngine<Key>;
+    static constexpr const char* name = "direct";
+    std::vector<Key> input;
+
+    void generate(std::vector<Key> keys) { input = std::move(keys); }
+    void load(Engine& engine) const { engine.arr = input; }
+    void finish(const Engine&) {}
+    bool sorted(const Engine& engine) const { return std::is_sorted(engine.arr.begin(), engine.arr.end()); }
+    bool selected(const Engine& engine, size_t k, bool ordered) const { return isSelected(engine.arr.begin(), engine.arr.end(), k, std::less<>(), ordered); }
+};
+
+// Sorts the records themselves, moving every payload along with its key.
+template <typename Key>
+struct RecordLayout {
+    using Engine = BasicSortEngine<SortRecord<Key>, RecordKey<Key>>;
+    static constexpr const char* name = "records";
+    std::vector<SortRecord<Key>> input;
+
+    void generate(const std::vector<Key>& keys) { input = makeRecords(keys); }
+    void load(Engine& engine) const { engine.arr = input; }
+    void finish(const Engine&) {}
+
+    bool sorted(const Engine& engine) const {
+        return std::is_sorted(engine.arr.begin(), engine.arr.end(), typename Engine::Before());
+    }
+
+    bool selected(const Engine& engine, size_t k, bool ordered) const {
+        return isSelected(engine.arr.begin(), engine.arr.end(), k, typename Engine::Before(), ordered);
+    }
+};
+
+// Sorts 32-bit indices by the key of the record they point at, then gathers the records into
+// sorted order once.
+template <typename Key>
+struct IndirectLayout {
+    using Engine = BasicSortEngine<uint32_t, IndexedKey<Key>>;
+    static constexpr const char* name = "indirect";
+    std::vector<SortRecord<Key>> input;
+    std::vector<SortRecord<Key>> output;
+
+    void generate(const std::vector<Key>& keys) {
+        if (keys.size() > UINT32_MAX) throw std::length_error("indirect layout needs fewer than 2^32 records");
+        input = makeRecords(keys);
+        output.resize(input.size());
+    }
+
+    void load(Engine& engine) const {
+        engine.keyOf.records = input.data();
+        engine.arr.resize(input.size());
+        for (size_t i = 0; i < input.size(); ++i) {
+            engine.arr[i] = static_cast<uint32_t>(i);
+        }
+    }
+
+    void finish(const Engine& engine) {
+        for (size_t i = 0; i < output.size(); ++i) {
+            output[i] = input[engine.arr[i]];
+        }
+    }
+
+    bool sorted(const Engine&) const {
+        return std::is_sorted(output.begin(), output.end(), typename RecordLayout<Key>::Engine::Before());
+    }
+
+    bool selected(const Engine&, size_t k, bool ordered) const {
+        return isSelected(output.begin(), output.end(), k, typename RecordLayout<Key>::Engine::Before(), ordered);
+    }
+};
+
+// Compares the selection algorithms among results[firstRow, end), all on one input, with the
+// full Quick Sort of it if that was run too.
+void reportSelectionSavings(const std::vector<BenchResult>& results, size_t firstRow) {
+    auto full = std::find_if(results.begin() + firstRow, results.end(), [](const BenchResult& r) { return std::string(r.algorithm->id) == "quick"; });
+    if (full == results.end()) return;
+    for (size_t i = firstRow; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        if (r.algorithm->output == SortOutput::Sorted) continue;
+        std::cerr << "  " << r.algorithm->id << " k=" << r.selectCount << ": " << std::fixed << std::setprecision(0)
+                  << 100.0 * r.comparisons / std::max(full->comparisons, 1ULL) << "% of quick's comparisons, "
+                  << 100.0 * r.swaps / std::max(full->swaps, 1ULL) << "% of its swaps, "
+                  << 100.0 * r.wallMs / std::max(full->wallMs, 1e-9) << "% of its time\n"
+                  << std::defaultfloat << std::setprecision(6);
+    }
+}
+
+// Runs every selected algorithm without a window. Each repetition uses its own seed and all
+// algorithms see the same input for a given (size, distribution, repetition), so rows are
+// comparable.
+// Parallel algorithms run once per configured thread count to give a speedup curve.
+template <class Layout>
+void benchmarkLayout(const BenchConfig& config, const char* keyName, const std::vector<std::unique_ptr<ThreadPool>>& pools, std::vector<BenchResult>& results) {
+    using Key = typename Layout::Engine::Key;
+    typename Layout::Engine engine;
+    engine.radixBits = config.radixBits;
+    engine.heapArity = config.heapArity;
+    engine.selectCount = config.selectCount;
+    std::unique_ptr<CacheSimulator> cache;
+    if (!config.cacheLevels.empty()) {
+        cache = std::make_unique<CacheSimulator>(config.cacheLevels, config.cacheLine);
+        engine.cache = cache.get();
+        engine.observed = true; // So the block partition and the parallel sorts report every access
+    }
+    Layout layout;
+    for (size_t size : config.sizes) {
+        for (size_t d : config.distributionIndices) {
+            const DistributionInfo& distribution = distributions[d];
+            for (int rep = 0; rep < config.repetitions; ++rep) {
+                unsigned seed = config.seed + rep;
+                layout.generate(benchInput<Key>(config, distribution, size, seed));
+                layout.load(engine);
+                InputProfile profile = profileInput(engine.arr, engine.keyOf, engine.less);
+                size_t firstRow = results.size();
+                for (size_t index : config.algorithmIndices) {
+                    const AlgorithmInfo& info = algorithms[index];
+                    const AlgorithmInfo& resolved = info.automatic ? *chooseAlgorithm(profile).algorithm : info;
+                    if (resolved.quadratic && size > config.quadraticLimit) {
+                        if (rep == 0) {
+                            std::cerr << "Skipping " << info.id << " at n=" << size << " (above --max-quadratic)\n";
+                        }
+                        continue;
+                    }
+                    size_t variants = info.parallel ? pools.size() : 1;
+                    for (size_t v = 0; v < variants; ++v) {
+                        engine.pool = info.parallel ? pools[v].get() : nullptr;
+                        layout.load(engine);
+                        engine.resetCounters();
+                        if (cache) cache->clear();
+                        unsigned long long allocationsBefore = heapAllocations.load(std::memory_order_relaxed);
+                        PerfCounters::Sample countersBefore = processCounters().read();
+                        auto start = std::chrono::steady_clock::now();
+                        SortTask task = runAlgorithm(engine, info);
+                        task.run();
+                        layout.finish(engine);
+                        auto end = std::chrono::steady_clock::now();
+                        PerfCounters::Sample countersAfter = processCounters().read();
+                        task.reset();
+                        BenchResult result;
+                        result.algorithm = &info;
+                        result.distribution = &distribution;
+                        result.key = keyName;
+                        result.layout = Layout::name;
+                        result.size = size;
+                        result.threads = info.parallel ? pools[v]->size() : 1;
+                        result.repetition = rep;
+                        result.seed = seed;
+                        result.profile = profile;
+                        result.wallMs = std::chrono::duration<double, std::milli>(end - start).count();
+                        result.comparisons = engine.comparisons;
+                        result.swaps = engine.swaps;
+                        result.allocations = heapAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+                        result.counters = countersAfter - countersBefore;
+                        if (cache) {
+                            for (const auto& level : cache->levels()) {
+                                result.cache.emplace_back(level.hits, level.misses);
+                            }
+                        }
+                        result.selectCount = info.output == SortOutput::Sorted ? 0 : engine.selectionSize();
+                        result.sorted = info.output == SortOutput::Sorted ? layout.sorted(engine)
+                                                                           : layout.selected(engine, result.selectCount, info.output == SortOutput::SortedPrefix);
+                        results.push_back(result);
+                        std::cerr << info.id << " " << distribution.id << " n=" << size << " threads=" << result.threads << " rep=" << rep << ": " << result.wallMs << " ms";
+                        if (info.automatic) std::cerr << " (chose " << chooseAlgorithm(profile).algorithm->id << ")";
+                        std::cerr << "\n";
+                    }
+                }
+                reportSelectionSavings(results, firstRow);
+            }
+        }
+    }
+}
+
+template <typename Key>
+void benchmarkKey(const BenchConfig& config, const char* keyName, const std::vector<std::unique_ptr<ThreadPool>>& pools, std::vector<BenchResult>& results) {
+    if (config.layout == "records") {
+        benchmarkLayout<RecordLayout<Key>>(config, keyName, pools, results);
+    } else if (config.layout == "indirect") {
+        benchmarkLayout<IndirectLayout<Key>>(config, keyName, pools, results);
+    } else {
+        benchmarkLayout<DirectLayout<Key>>(config, keyName, pools, results);
+    }
+}
+
+std::vector<BenchResult> runBenchmark(const BenchConfig& config) {
+    std::vector<BenchResult> results;
+    std::vector<std::unique_ptr<ThreadPool>> pools;
+    for (size_t threads : config.threadCounts) {
+        pools.push_back(std::make_unique<ThreadPool>(threads));
+    }
+    if (config.keyType == "uint64") {
+        benchmarkKey<uint64_t>(config, "uint64", pools, results);
+    } else if (config.keyType == "float") {
+        benchmarkKey<float>(config, "float", pools, results);
+    } else if (config.keyType == "double") {
+        benchmarkKey<double>(config, "double", pools, results);
+    } else {
+        benchmarkKey<int32_t>(config, "int32", pools, results);
+    }
+    return results;
+}
+
+// Simulated cache levels get a column pair each, e.g. sim_l1_hits and sim_l1_misses.
+void writeBenchResults(std::ostream& out, const std::vector<BenchResult>& results, const BenchConfig& config) {
+    std::vector<std::string> levelColumns;
+    for (const auto& level : config.cacheLevels) {
+        std::string name = level.name;
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        levelColumns.push_back("sim_" + name);
+    }
+    out << std::fixed << std::setprecision(3);
+    if (config.json) {
+        out << "[\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            out << "  {\"algorithm\": \"" << r.algorithm->id << "\", \"distribution\": \"" << r.distribution->id << "\", \"key\": \"" << r.key << "\", \"layout\": \"" << r.layout
+                << "\", \"size\": " << r.size << ", \"k\": " << r.selectCount
+                << ", \"threads\": " << r.threads << ", \"rep\": " << r.repetition << ", \"seed\": " << r.seed
+                << ", \"range\": " << r.profile.range << ", \"duplicates\": " << r.profile.duplicates << ", \"descents\": " << r.profile.descents << ", \"inversions\": " << r.profile.inversions
+                << ", \"wall_ms\": " << r.wallMs << ", \"ns_per_element\": " << (r.wallMs * 1e6 / std::max<size_t>(r.size, 1))
+                << ", \"comparisons\": " << r.comparisons << ", \"swaps\": " << r.swaps << ", \"allocations\": " << r.allocations;
+            for (int e = 0; e < PerfCounters::EventCount; ++e) {
+                out << ", \"" << PerfCounters::name(e) << "\": ";
+                if (r.counters.valid[e]) out << r.counters.values[e]; else out << "null";
+            }
+            if (!r.cache.empty()) {
+                out << ", \"cache\": {";
+                for (size_t l = 0; l < r.cache.size(); ++l) {
+                    out << (l ? ", " : "") << "\"" << config.cacheLevels[l].name << "\": {\"hits\": " << r.cache[l].first << ", \"misses\": " << r.cache[l].second << "}";
+                }
+                out << "}";
+            }
+            out << ", \"sorted\": " << (r.sorted ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "]\n";
+    } else {
+        out << "algorithm,distribution,key,layout,size,k,threads,rep,seed,range,duplicates,descents,inversions,wall_ms,ns_per_element,comparisons,swaps,allocations,";
+        for (int e = 0; e < PerfCounters::EventCount; ++e) {
+            out << PerfCounters::name(e) << ",";
+        }
+        for (const auto& column : levelColumns) {
+            out << column << "_hits," << column << "_misses,";
+        }
+        out << "sorted\n";
+        for (const BenchResult& r : results) {
+            out << r.algorithm->id << "," << r.distribution->id << "," << r.key << "," << r.layout << "," << r.size << "," << r.selectCount << "," << r.threads << "," << r.repetition << "," << r.seed << ","
+                << r.profile.range << "," << r.profile.duplicates << "," << r.profile.descents << "," << r.profile.inversions << ","
+                << r.wallMs << "," << (r.wallMs * 1e6 / std::max<size_t>(r.size, 1)) << ","
+                << r.comparisons << "," << r.swaps << "," << r.allocations << ",";
+            for (int e = 0; e < PerfCounters::EventCount; ++e) {
+                if (r.counters.valid[e]) out << r.counters.values[e]; // Left empty when the counter is unavailable
+                out << ",";
+            }
+            for (const auto& [hits, misses] : r.cache) {
+                out << hits << "," << misses << ",";
+            }
+            out << (r.sorted ? 1 : 0) << "\n";
+        }
+    }
+}
+
+// Runs one algorithm headless at full speed and records every step into a trace file.
+bool recordTrace(const std::string& path, const AlgorithmInfo& info, size_t size, const BenchConfig& config, uint64_t keyframeInterval) {
+    SortEngine engine;
+    engine.radixBits = config.radixBits;
+    engine.heapArity = config.heapArity;
+    engine.selectCount = config.selectCount;
+    engine.arr = benchInput(config, distributions[config.distributionIndices[0]], size, config.seed);
+    TraceWriter writer;
+    if (keyframeInterval == 0) {
+        keyframeInterval = std::max<uint64_t>(1 << 16, 4 * size); // Keeps snapshots to about one byte per step
+    }
+    if (!writer.open(path, info.id, engine.arr, keyframeInterval)) {
+        std::cerr << "Cannot create trace " << path << "\n";
+        return false;
+    }
+    engine.trace = &writer;
+    SortTask task = runAlgorithm(engine, info);
+    auto start = std::chrono::steady_clock::now();
+    try {
+        task.run();
+    } catch (const std::exception& e) {
+        std::cerr << "Recording failed: " << e.what() << "\n";
+        return false;
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t steps = writer.steps();
+    writer.close();
+    std::cerr << "Recorded " << info.id << " on " << size << " elements: " << steps << " steps, "
+              << writer.bytesWritten() << " bytes (" << std::fixed << std::setprecision(2) << double(writer.bytesWritten()) / std::max<uint64_t>(steps, 1)
+              << " bytes/step) in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+    return true;
+}
+
+// Writes rendered frames on encoder threads, either as one Y4M stream (4:2:0, full-range
+// BT.601 with each chroma sample averaged over a 2x2 block) or as numbered PNG files in a
+// directory. Frames wait in a bounded queue, so rendering stalls instead of buffering the
+// whole clip when the encoders fall behind. Y4M frames are converted in parallel and
+// appended in order.
+class FrameExporter {
+public:
+    FrameExporter(std::string outputPath, unsigned frameWidth, unsigned frameHeight, unsigned framesPerSecond)
+        : path(std::move(outputPath)), width(frameWidth), height(frameHeight), fps(framesPerSecond) {
+        y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+    }
+
+    ~FrameExporter() {
+        std::string ignored;
+        finish(ignored);
+    }
+
+    bool open(size_t threads, std::string& error) {
+        if (y4m) {
+            stream.open(path, std::ios::binary);
+            if (!stream) {
+                error = "cannot create " + path;
+                return false;
+            }
+            stream << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n";
+        } else {
+            std::error_code code;
+            std::filesystem::create_directories(path, code);
+            if (code) {
+                error = "cannot create " + path + ": " + code.message();
+                return false;
+            }
         }
-        window.display();
-        if (isSorting && !isPaused) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        capacity = 2 * threads;
+        for (size_t t = 0; t < threads; ++t) {
+            encoders.emplace_back([this] { encodeFrames(); });
         }
+        return true;
     }
 
-    void updateDetails(const std::string& details) {
-        algorithmDetails = wrapText("Algorithm: " + currentAlgorithm + (isPaused ? "\nPaused" : "") + "\n" + details, 780);
-        detailsText.setString(algorithmDetails);
+    // Blocks while the queue is full.
+    void push(sf::Image image) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return queue.size() < capacity; });
+        queue.push_back({pushed++, std::move(image)});
+        notEmpty.notify_one();
     }
 
-    void resetColors() {
-        for (auto& bar : bars) {
-            bar.setFillColor(isSorting ? sf::Color(75, 156, 234) : sf::Color(85, 255, 85)); // Green when sorted
+    // Waits for every queued frame to be written.
+    bool finish(std::string& error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+            notEmpty.notify_all();
         }
+        for (auto& encoder : encoders) encoder.join();
+        encoders.clear();
+        if (stream.is_open()) stream.close();
+        error = failure;
+        return failure.empty();
     }
 
-    void resetArray() {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(10, 400);
-        for (size_t i = 0; i < arr.size(); ++i) {
-            updateBar(i, dis(gen));
-            bars[i].setFillColor(sf::Color(75, 156, 234));
-        }
-        currentAlgorithm = "None";
-        activeAlgorithmIndex = -1;
-        comparisons = 0;
-        swaps = 0;
-        updateStats();
-        updateDetails("Select an algorithm by clicking or using keys 1-0.");
-        draw();
+    uint64_t frames() const { return pushed; }
+
+private:
+    struct Frame {
+        uint64_t index;
+        sf::Image image;
+    };
+
+    std::string path;
+    unsigned width, height, fps;
+    bool y4m;
+    std::ofstream stream; // The Y4M file
+    std::vector<std::thread> encoders;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<Frame> queue;
+    size_t capacity = 0;
+    uint64_t pushed = 0;
+    bool closing = false;
+    std::string failure; // First error of any encoder
+    std::mutex writeMutex;
+    std::condition_variable turn; // Signalled whenever a Y4M frame has been appended
+    uint64_t written = 0;
+
+    void fail(const std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failure.empty()) failure = error;
     }
 
-    void handleMouseClick(sf::Vector2i mousePos) {
-        if (isSorting && !isPaused) return;
-        for (size_t i = 0; i < algorithmButtons.size(); ++i) {
-            if (algorithmButtons[i].getGlobalBounds().contains(static_cast<float>(mousePos.x), static_cast<float>(mousePos.y))) {
-                activeAlgorithmIndex = i;
-                switch (i) {
-                    case 0: bubbleSort(); break;
-                    case 1: selectionSort(); break;
-                    case 2: insertionSort(); break;
-                    case 3: startQuickSort(); break;
-                    case 4: startMergeSort(); break;
-                    case 5: startHeapSort(); break;
-                    case 6: timSort(); break;
-                    case 7: countingSort(); break;
-                    case 8: radixSort(); break;
-                    case 9: bucketSort(); break;
-                }
-                break;
-            }
-        }
+    std::string framePath(uint64_t index) const {
+        std::ostringstream name;
+        name << path << "/frame_" << std::setw(6) << std::setfill('0') << index << ".png";
+        return name.str();
     }
 
-    void bubbleSort() {
-        isSorting = true;
-        currentAlgorithm = "Bubble Sort";
-        activeAlgorithmIndex = 0;
-        updateDetails("Time: O(n^2)\nSpace: O(1)\nCompares adjacent elements, swaps if out of order.");
-        comparisons = 0;
-        swaps = 0;
-        for (size_t i = 0; i < arr.size() - 1 && isSorting; ++i) {
-            bool swapped = false;
-            for (size_t j = 0; j < arr.size() - i - 1 && isSorting && !isPaused; ++j) {
-                setBarColor(j, sf::Color(255, 85, 85));
-                setBarColor(j + 1, sf::Color(255, 85, 85));
-                draw();
-                comparisons++;
-                if (arr[j] > arr[j + 1]) {
-                    std::swap(arr[j], arr[j + 1]);
-                    updateBar(j, arr[j]);
-                    updateBar(j + 1, arr[j + 1]);
-                    swaps++;
-                    swapped = true;
+    void toYuv420(const sf::Image& image, std::vector<uint8_t>& yuv) const {
+        const uint8_t* rgba = image.getPixelsPtr();
+        const size_t chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+        yuv.resize(size_t(width) * height + 2 * chromaWidth * chromaHeight);
+        uint8_t* luma = yuv.data();
+        uint8_t* cb = luma + size_t(width) * height;
+        uint8_t* cr = cb + chromaWidth * chromaHeight;
+        for (size_t i = 0; i < size_t(width) * height; ++i) {
+            const uint8_t* p = rgba + 4 * i;
+            luma[i] = static_cast<uint8_t>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+        }
+        for (size_t y = 0; y < chromaHeight; ++y) {
+            for (size_t x = 0; x < chromaWidth; ++x) {
+                int r = 0, g = 0, b = 0;
+                for (size_t dy = 0; dy < 2; ++dy) {
+                    for (size_t dx = 0; dx < 2; ++dx) {
+                        const uint8_t* p = rgba + 4 * (std::min<size_t>(2 * y + dy, height - 1) * width + std::min<size_t>(2 * x + dx, width - 1));
+                        r += p[0];
+                        g += p[1];
+                        b += p[2];
+                    }
                 }
-                updateStats();
-                setBarColor(j, sf::Color(75, 156, 234));
-                setBarColor(j + 1, sf::Color(75, 156, 234));
+                // Sums of four samples, hence the extra shift by 2.
+                cb[y * chromaWidth + x] = static_cast<uint8_t>(std::clamp(((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128, 0, 255));
+                cr[y * chromaWidth + x] = static_cast<uint8_t>(std::clamp(((128 * r - 107 * g - 21 * b + 512) >> 10) + 128, 0, 255));
             }
-            if (!swapped) break;
         }
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
     }
 
-    void selectionSort() {
-        isSorting = true;
-        currentAlgorithm = "Selection Sort";
-        activeAlgorithmIndex = 1;
-        updateDetails("Time: O(n^2)\nSpace: O(1)\nFinds minimum in unsorted portion, places at start.");
-        comparisons = 0;
-        swaps = 0;
-        for (size_t i = 0; i < arr.size() - 1 && isSorting; ++i) {
-            size_t minIdx = i;
-            for (size_t j = i + 1; j < arr.size() && isSorting && !isPaused; ++j) {
-                setBarColor(j, sf::Color(255, 85, 85));
-                setBarColor(minIdx, sf::Color(255, 255, 85));
-                draw();
-                comparisons++;
-                if (arr[j] < arr[minIdx]) {
-                    setBarColor(minIdx, sf::Color(75, 156, 234));
-                    minIdx = j;
-                }
-                updateStats();
-                setBarColor(j, sf::Color(75, 156, 234));
+    void encodeFrames() {
+        std::vector<uint8_t> yuv;
+        while (true) {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                notEmpty.wait(lock, [&] { return closing || !queue.empty(); });
+                if (queue.empty()) return;
+                frame = std::move(queue.front());
+                queue.pop_front();
+                notFull.notify_one();
             }
-            if (minIdx != i) {
-                std::swap(arr[i], arr[minIdx]);
-                updateBar(i, arr[i]);
-                updateBar(minIdx, arr[minIdx]);
-                swaps++;
+            if (!y4m) {
+                if (!frame.image.saveToFile(framePath(frame.index))) fail("cannot write " + framePath(frame.index));
+                continue;
             }
-            setBarColor(i, sf::Color(75, 156, 234));
-            setBarColor(minIdx, sf::Color(75, 156, 234));
+            toYuv420(frame.image, yuv);
+            std::unique_lock<std::mutex> lock(writeMutex);
+            turn.wait(lock, [&] { return written == frame.index; });
+            stream << "FRAME\n";
+            stream.write(reinterpret_cast<const char*>(yuv.data()), static_cast<std::streamsize>(yuv.size()));
+            if (!stream) fail("cannot write " + path);
+            ++written;
+            turn.notify_all();
         }
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
     }
+};
 
-    void insertionSort() {
-        isSorting = true;
-        currentAlgorithm = "Insertion Sort";
-        activeAlgorithmIndex = 2;
-        updateDetails("Time: O(n^2)\nSpace: O(1)\nInserts each element into sorted portion.");
-        comparisons = 0;
-        swaps = 0;
-        for (size_t i = 1; i < arr.size() && isSorting; ++i) {
-            int key = arr[i];
-            size_t j = i;
-            setBarColor(j, sf::Color(255, 85, 85));
-            draw();
-            while (j > 0 && arr[j - 1] > key && isSorting && !isPaused) {
-                comparisons++;
-                arr[j] = arr[j - 1];
-                updateBar(j, arr[j]);
-                setBarColor(j - 1, sf::Color(255, 85, 85));
-                draw();
-                setBarColor(j - 1, sf::Color(75, 156, 234));
-                --j;
-                swaps++;
-            }
-            arr[j] = key;
-            updateBar(j, arr[j]);
-            setBarColor(j, sf::Color(75, 156, 234));
-            updateStats();
-        }
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
-    }
-
-    int partition(int low, int high) {
-        if (!isSorting || isPaused) return low;
-        int pivot = arr[high];
-        setBarColor(high, sf::Color(255, 255, 85));
-        int i = low - 1;
-        for (int j = low; j < high && isSorting && !isPaused; ++j) {
-            setBarColor(j, sf::Color(255, 85, 85));
-            draw();
-            comparisons++;
-            if (arr[j] <= pivot) {
-                ++i;
-                std::swap(arr[i], arr[j]);
-                updateBar(i, arr[i]);
-                updateBar(j, arr[j]);
-                swaps++;
-            }
-            setBarColor(j, sf::Color(75, 156, 234));
-            updateStats();
-        }
-        std::swap(arr[i + 1], arr[high]);
-        updateBar(i + 1, arr[i + 1]);
-        updateBar(high, arr[high]);
-        swaps++;
-        setBarColor(high, sf::Color(75, 156, 234));
-        setBarColor(i + 1, sf::Color(75, 156, 234));
-        draw();
-        return i + 1;
+struct ExportOptions {
+    std::string path; // Ends in .y4m for a Y4M stream, otherwise a directory of PNG files
+    unsigned long long opsPerFrame = 16;
+    unsigned fps = 60;
+    size_t encoders = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// Runs one algorithm offscreen and exports a frame after every opsPerFrame steps (and one of
+// the input first), as fast as frames can be rendered and read back.
+bool exportFrames(const ExportOptions& options, const AlgorithmInfo& info, int size, const BenchConfig& config) {
+    sf::RenderTexture texture;
+    if (!texture.create(800, 600)) {
+        std::cerr << "Cannot create an offscreen render target\n";
+        return false;
+    }
+    SortingVisualizer visualizer(texture, size, 256, config.seed);
+    visualizer.selectDistribution(config.distributionIndices[0]);
+    visualizer.setCacheLevels(config.cacheLevels, config.cacheLine);
+    if (config.selectCount) visualizer.setSelectCount(config.selectCount);
+    if (!config.cacheLevels.empty()) visualizer.enableCacheSimulator(true);
+    FrameExporter exporter(options.path, 800, 600, options.fps);
+    std::string error;
+    if (!exporter.open(options.encoders, error)) {
+        std::cerr << "Cannot export: " << error << "\n";
+        return false;
     }
+    auto start = std::chrono::steady_clock::now();
+    visualizer.startAlgorithm(&info - algorithms.data());
+    do {
+        visualizer.draw();
+        texture.display();
+        exporter.push(texture.getTexture().copyToImage());
+    } while (visualizer.advanceBy(options.opsPerFrame));
+    if (!exporter.finish(error)) {
+        std::cerr << "Export failed: " << error << "\n";
+        return false;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cerr << "Exported " << exporter.frames() << " frames of " << info.id << " on " << size << " elements to " << options.path << " in "
+              << std::fixed << std::setprecision(0) << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+    return true;
+}
+
+// External sort of a binary file of keys (POSIX only): sorted runs of a bounded size are
+// produced by one of the in-memory algorithms and written to a temporary file, then merged
+// with a loser tree. Input and runs are read through mmap with madvise read-ahead, and
+// output goes through a double-buffered writer thread.
 
-    void quickSort(int low, int high) {
-        if (!isSorting || low >= high || isPaused) return;
-        int pi = partition(low, high);
-        quickSort(low, pi - 1);
-        quickSort(pi + 1, high);
+// Read-only mapping of a whole file. Pages can be requested ahead of use and dropped after.
+class MappedFile {
+private:
+    const unsigned char* base = nullptr;
+    size_t fileSize = 0;
+
+    // Applies `advice` to the pages covering [offset, offset + bytes).
+    void advise(size_t offset, size_t bytes, int advice) const {
+#ifndef _WIN32
+        if (!base || offset >= fileSize) return;
+        static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t end = std::min(fileSize, offset + bytes);
+        size_t from = offset / page * page;
+        madvise(const_cast<unsigned char*>(base) + from, end - from, advice);
+#else
+        (void)offset; (void)bytes; (void)advice;
+#endif
     }
 
-    void startQuickSort() {
-        isSorting = true;
-        currentAlgorithm = "Quick Sort";
-        activeAlgorithmIndex = 3;
-        updateDetails("Time: O(n log n) avg, O(n^2) worst\nSpace: O(log n)\nPartitions around a pivot.");
-        comparisons = 0;
-        swaps = 0;
-        quickSort(0, arr.size() - 1);
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
-    }
-
-    void merge(int left, int mid, int right) {
-        if (!isSorting || isPaused) return;
-        std::vector<int> temp(right - left + 1);
-        size_t i = left, j = mid + 1, k = 0;
-        while (i <= mid && j <= right && isSorting && !isPaused) {
-            setBarColor(i, sf::Color(255, 85, 85));
-            setBarColor(j, sf::Color(255, 85, 85));
-            draw();
-            comparisons++;
-            if (arr[i] <= arr[j]) {
-                temp[k++] = arr[i++];
-            } else {
-                temp[k++] = arr[j++];
-            }
-            setBarColor(i, sf::Color(75, 156, 234));
-            setBarColor(j, sf::Color(75, 156, 234));
-            updateStats();
+public:
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path, std::string& error) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return false;
         }
-        while (i <= mid && isSorting && !isPaused) {
-            temp[k++] = arr[i++];
-            setBarColor(i, sf::Color(75, 156, 234));
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            error = "cannot stat " + path;
+            return false;
         }
-        while (j <= right && isSorting && !isPaused) {
-            temp[k++] = arr[j++];
-            setBarColor(j, sf::Color(75, 156, 234));
+        fileSize = info.st_size;
+        if (fileSize > 0) {
+            void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                error = "mmap failed for " + path;
+                return false;
+            }
+            base = static_cast<const unsigned char*>(mapped);
+            madvise(const_cast<unsigned char*>(base), fileSize, MADV_SEQUENTIAL);
         }
-        for (size_t idx = 0; idx < temp.size() && isSorting && !isPaused; ++idx) {
-            updateBar(left + idx, temp[idx]);
-            setBarColor(left + idx, sf::Color(85, 255, 85));
-            draw();
-            setBarColor(left + idx, sf::Color(75, 156, 234));
+        ::close(fd);
+        return true;
+#else
+        (void)path;
+        error = "external sort is not supported on this platform";
+        return false;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (base) munmap(const_cast<unsigned char*>(base), fileSize);
+#endif
+        base = nullptr;
+        fileSize = 0;
+    }
+
+    const unsigned char* data() const { return base; }
+    size_t size() const { return fileSize; }
+
+#ifndef _WIN32
+    void willNeed(size_t offset, size_t bytes) const { advise(offset, bytes, MADV_WILLNEED); }
+    void release(size_t offset, size_t bytes) const { advise(offset, bytes, MADV_DONTNEED); }
+#else
+    void willNeed(size_t, size_t) const {}
+    void release(size_t, size_t) const {}
+#endif
+};
+
+// Writes a file in large blocks from a background thread: one block is filled while the
+// previous one is being written.
+class BlockWriter {
+private:
+    int fd = -1;
+    std::vector<unsigned char> filling;
+    std::vector<unsigned char> flushing;
+    size_t used = 0;
+    size_t flushBytes = 0;
+    bool pending = false; // `flushing` holds a block not yet written
+    bool stopping = false;
+    bool failed = false;
+    uint64_t written = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    void writerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return pending || stopping; });
+            if (!pending) return;
+            lock.unlock();
+            bool ok = writeAll(flushing.data(), flushBytes);
+            lock.lock();
+            failed = failed || !ok;
+            pending = false;
+            changed.notify_all();
         }
     }
 
-    void mergeSort(int left, int right) {
-        if (!isSorting || left >= right || isPaused) return;
-        int mid = left + (right - left) / 2;
-        mergeSort(left, mid);
-        mergeSort(mid + 1, right);
-        merge(left, mid, right);
+    bool writeAll(const unsigned char* data, size_t bytes) {
+#ifndef _WIN32
+        while (bytes > 0) {
+            ssize_t n = ::write(fd, data, bytes);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            bytes -= n;
+            written += n;
+        }
+        return true;
+#else
+        (void)data; (void)bytes;
+        return false;
+#endif
     }
 
-    void startMergeSort() {
-        isSorting = true;
-        currentAlgorithm = "Merge Sort";
-        activeAlgorithmIndex = 4;
-        updateDetails("Time: O(n log n)\nSpace: O(n)\nDivides and merges sorted halves.");
-        comparisons = 0;
-        swaps = 0;
-        mergeSort(0, arr.size() - 1);
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
-    }
-
-    void heapify(int n, int i) {
-        if (!isSorting || isPaused) return;
-        int largest = i;
-        int left = 2 * i + 1;
-        int right = 2 * i + 2;
-        if (left < n && arr[left] > arr[largest]) {
-            comparisons++;
-            largest = left;
-        }
-        if (right < n && arr[right] > arr[largest]) {
-            comparisons++;
-            largest = right;
-        }
-        if (largest != i && isSorting && !isPaused) {
-            std::swap(arr[i], arr[largest]);
-            updateBar(i, arr[i]);
-            updateBar(largest, arr[largest]);
-            swaps++;
-            setBarColor(i, sf::Color(255, 85, 85));
-            setBarColor(largest, sf::Color(255, 85, 85));
-            draw();
-            setBarColor(i, sf::Color(75, 156, 234));
-            setBarColor(largest, sf::Color(75, 156, 234));
-            heapify(n, largest);
+    // Hands the filled block to the writer thread once it has finished the previous one.
+    void handOff() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !pending; });
+        std::swap(filling, flushing);
+        flushBytes = used;
+        used = 0;
+        pending = true;
+        changed.notify_all();
+    }
+
+public:
+    ~BlockWriter() {
+        std::string ignored;
+        close(ignored);
+    }
+
+    bool open(const std::string& path, size_t blockBytes, std::string& error) {
+#ifndef _WIN32
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            error = "cannot create " + path;
+            return false;
         }
-        updateStats();
+        filling.resize(blockBytes);
+        flushing.resize(blockBytes);
+        used = 0;
+        written = 0;
+        pending = stopping = failed = false;
+        thread = std::thread(&BlockWriter::writerLoop, this);
+        return true;
+#else
+        (void)path; (void)blockBytes;
+        error = "external sort is not supported on this platform";
+        return false;
+#endif
     }
 
-    void startHeapSort() {
-        isSorting = true;
-        currentAlgorithm = "Heap Sort";
-        activeAlgorithmIndex = 5;
-        updateDetails("Time: O(n log n)\nSpace: O(1)\nUses a max heap to sort elements.");
-        comparisons = 0;
-        swaps = 0;
-        int n = arr.size();
-        for (int i = n / 2 - 1; i >= 0 && isSorting && !isPaused; --i) {
-            heapify(n, i);
-        }
-        for (int i = n - 1; i > 0 && isSorting && !isPaused; --i) {
-            std::swap(arr[0], arr[i]);
-            updateBar(0, arr[0]);
-            updateBar(i, arr[i]);
-            swaps++;
-            draw();
-            heapify(i, 0);
+    void write(const void* data, size_t bytes) {
+        const unsigned char* from = static_cast<const unsigned char*>(data);
+        while (bytes > 0) {
+            size_t chunk = std::min(bytes, filling.size() - used);
+            std::memcpy(filling.data() + used, from, chunk);
+            used += chunk;
+            from += chunk;
+            bytes -= chunk;
+            if (used == filling.size()) handOff();
         }
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
     }
 
-    void timSort() {
-        isSorting = true;
-        currentAlgorithm = "Tim Sort";
-        activeAlgorithmIndex = 6;
-        updateDetails("Time: O(n log n)\nSpace: O(n)\nHybrid of merge and insertion sort.");
-        comparisons = 0;
-        swaps = 0;
-        const int RUN = 32;
-        for (size_t i = 0; i < arr.size() && isSorting && !isPaused; i += RUN) {
-            for (size_t j = i + 1; j < std::min(i + RUN, arr.size()) && isSorting && !isPaused; ++j) {
-                int key = arr[j];
-                size_t k = j;
-                setBarColor(k, sf::Color(255, 85, 85));
-                draw();
-                while (k > i && arr[k - 1] > key && isSorting && !isPaused) {
-                    comparisons++;
-                    arr[k] = arr[k - 1];
-                    updateBar(k, arr[k]);
-                    setBarColor(k - 1, sf::Color(255, 85, 85));
-                    draw();
-                    setBarColor(k - 1, sf::Color(75, 156, 234));
-                    --k;
-                    swaps++;
-                }
-                arr[k] = key;
-                updateBar(k, arr[k]);
-                setBarColor(k, sf::Color(75, 156, 234));
-                updateStats();
-            }
+    // Flushes the last block and closes the file. Returns false if any write failed.
+    bool close(std::string& error) {
+        if (fd < 0) return true;
+        if (used > 0) handOff();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
-        for (size_t size = RUN; size < arr.size() && isSorting && !isPaused; size *= 2) {
-            for (size_t left = 0; left < arr.size() && isSorting && !isPaused; left += 2 * size) {
-                size_t mid = left + size - 1;
-                size_t right = std::min(left + 2 * size - 1, arr.size() - 1);
-                if (mid < right) {
-                    merge(left, mid, right);
-                }
-            }
+        changed.notify_all();
+        thread.join();
+#ifndef _WIN32
+        bool ok = !failed && ::close(fd) == 0;
+#else
+        bool ok = false;
+#endif
+        fd = -1;
+        if (!ok) error = "write failed";
+        return ok;
+    }
+
+    uint64_t bytesWritten() const { return written; }
+};
+
+// Tournament tree over k sources that keeps the loser of each match in the inner nodes, so
+// replacing the winner replays only its path to the root: log2(k) comparisons per key.
+// Ties go to the lower source, which keeps the merge stable.
+template <typename Key>
+class LoserTree {
+private:
+    size_t k = 0;
+    std::vector<size_t> tree; // tree[0] is the winner, tree[1..k-1] losers; leaf i is node k + i
+    std::vector<Key> heads;
+    std::vector<unsigned char> exhausted;
+
+    bool beats(size_t a, size_t b) const {
+        if (exhausted[a] || exhausted[b]) return !exhausted[a] && (exhausted[b] || a < b);
+        if (heads[a] < heads[b]) return true;
+        if (heads[b] < heads[a]) return false;
+        return a < b;
+    }
+
+    size_t build(size_t node) {
+        if (node >= k) return node - k;
+        size_t left = build(2 * node), right = build(2 * node + 1);
+        if (beats(left, right)) {
+            tree[node] = right;
+            return left;
         }
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
+        tree[node] = left;
+        return right;
     }
 
-    void countingSort() {
-        isSorting = true;
-        currentAlgorithm = "Counting Sort";
-        activeAlgorithmIndex = 7;
-        updateDetails("Time: O(n + k)\nSpace: O(k)\nCounts occurrences to sort non-negative integers.");
-        comparisons = 0;
-        swaps = 0;
-        int maxVal = *std::max_element(arr.begin(), arr.end());
-        std::vector<int> count(maxVal + 1, 0);
-        for (size_t i = 0; i < arr.size() && isSorting && !isPaused; ++i) {
-            ++count[arr[i]];
-            setBarColor(i, sf::Color(255, 85, 85));
-            draw();
-            setBarColor(i, sf::Color(75, 156, 234));
-        }
-        size_t k = 0;
-        for (int i = 0; i <= maxVal && isSorting && !isPaused; ++i) {
-            while (count[i] > 0 && isSorting && !isPaused) {
-                updateBar(k, i);
-                setBarColor(k, sf::Color(85, 255, 85));
-                draw();
-                setBarColor(k, sf::Color(75, 156, 234));
-                --count[i];
-                ++k;
-                swaps++;
-            }
+    void replay(size_t source) {
+        size_t winner = source;
+        for (size_t node = (source + k) / 2; node >= 1; node /= 2) {
+            if (beats(tree[node], winner)) std::swap(tree[node], winner);
         }
-        updateStats();
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
+        tree[0] = winner;
+    }
+
+public:
+    // Sets up k sources; set() or exhaust() every one of them, then call start().
+    void reset(size_t sources) {
+        k = sources;
+        tree.assign(std::max<size_t>(k, 1), 0);
+        heads.assign(k, Key());
+        exhausted.assign(k, 0);
+    }
+
+    void set(size_t source, Key key) { heads[source] = key; }
+    void exhaust(size_t source) { exhausted[source] = 1; }
+    void start() { tree[0] = k > 1 ? build(1) : 0; }
+
+    bool empty() const { return k == 0 || exhausted[tree[0]]; }
+    size_t winner() const { return tree[0]; }
+    Key top() const { return heads[tree[0]]; }
+
+    void advance(Key next) {
+        heads[tree[0]] = next;
+        replay(tree[0]);
+    }
+
+    void finishWinner() {
+        exhausted[tree[0]] = 1;
+        replay(tree[0]);
+    }
+};
+
+struct ExternalOptions {
+    std::string inputPath;
+    std::string outputPath;
+    std::string tempPath; // Runs file; outputPath + ".runs" if empty
+    size_t memoryBytes = size_t(512) << 20;
+    const AlgorithmInfo* algorithm = nullptr;
+    unsigned radixBits = 8;
+    unsigned heapArity = 2;
+};
+
+template <typename Key>
+class ExternalSorter {
+private:
+    ExternalOptions options;
+    ExternalProgress& progress;
+    MappedFile input;
+    size_t keysPerRun = 0;
+
+    static constexpr size_t writeBlockBytes = 8 << 20;
+
+    bool fail(const std::string& message) {
+        progress.error = message;
+        progress.phase = ExternalProgress::Failed;
+        return false;
     }
 
-    void countingSortForRadix(int exp) {
-        if (!isSorting || isPaused) return;
-        std::vector<int> output(arr.size());
-        std::vector<int> count(10, 0);
-        for (size_t i = 0; i < arr.size() && isSorting && !isPaused; ++i) {
-            ++count[(arr[i] / exp) % 10];
-            setBarColor(i, sf::Color(255, 85, 85));
-            draw();
-            setBarColor(i, sf::Color(75, 156, 234));
+    // Sorts each run in memory and appends it to `writer`, reading the next run ahead.
+    bool formRuns(BlockWriter& writer) {
+        BasicSortEngine<Key> engine;
+        engine.radixBits = options.radixBits;
+        engine.heapArity = options.heapArity;
+        const Key* keys = reinterpret_cast<const Key*>(input.data());
+        uint64_t start = 0;
+        for (size_t r = 0; r < progress.runLengths.size(); ++r) {
+            if (progress.cancelled) return fail("cancelled");
+            uint64_t length = progress.runLengths[r];
+            input.willNeed((start + length) * sizeof(Key), length * sizeof(Key));
+            engine.arr.assign(keys + start, keys + start + length);
+            input.release(start * sizeof(Key), length * sizeof(Key));
+            engine.resetCounters();
+            SortTask task = runAlgorithm(engine, *options.algorithm);
+            task.run();
+            task.reset();
+            writer.write(engine.arr.data(), length * sizeof(Key));
+            start += length;
+            progress.runsFormed = r + 1;
         }
-        for (int i = 1; i < 10; ++i) {
-            count[i] += count[i - 1];
+        return true;
+    }
+
+    // Merges every run of the runs file into `writer`. Each run is read through a window of
+    // `window` keys: when a run enters its current window the next one is requested and the
+    // previous one dropped, so resident memory stays near runs * 2 windows.
+    bool mergeRuns(const MappedFile& runs, BlockWriter& writer) {
+        struct Cursor {
+            const Key* next;
+            const Key* end;
+            const Key* first;
+            const Key* nextWindow; // Position at which the following window is requested
+        };
+        const size_t k = progress.runLengths.size();
+        const size_t window = std::clamp<size_t>(options.memoryBytes / (4 * k * sizeof(Key)), 4096, (8 << 20) / sizeof(Key));
+        const Key* base = reinterpret_cast<const Key*>(runs.data());
+        std::vector<Cursor> cursors(k);
+        LoserTree<Key> tree;
+        tree.reset(k);
+        uint64_t start = 0;
+        for (size_t r = 0; r < k; ++r) {
+            Cursor& c = cursors[r];
+            c.first = c.next = base + start;
+            c.end = c.first + progress.runLengths[r];
+            c.nextWindow = c.first;
+            start += progress.runLengths[r];
+            tree.set(r, *c.next);
+            runs.willNeed((c.first - base) * sizeof(Key), window * sizeof(Key));
         }
-        for (int i = arr.size() - 1; i >= 0 && isSorting && !isPaused; --i) {
-            output[count[(arr[i] / exp) % 10] - 1] = arr[i];
-            --count[(arr[i] / exp) % 10];
+        tree.start();
+
+        std::vector<Key> batch(writeBlockBytes / sizeof(Key));
+        size_t filled = 0;
+        uint64_t merged = 0;
+        while (!tree.empty()) {
+            size_t r = tree.winner();
+            Cursor& c = cursors[r];
+            batch[filled++] = tree.top();
+            if (++c.next == c.end) {
+                tree.finishWinner();
+            } else {
+                tree.advance(*c.next);
+            }
+            if (c.next >= c.nextWindow) {
+                size_t offset = c.nextWindow - base;
+                runs.willNeed((offset + window) * sizeof(Key), window * sizeof(Key));
+                if (c.nextWindow - c.first >= static_cast<ptrdiff_t>(window)) runs.release((offset - window) * sizeof(Key), window * sizeof(Key));
+                c.nextWindow = std::min(c.end, c.nextWindow + window);
+                progress.runsMerged[r] = c.next - c.first;
+            }
+            if (filled == batch.size()) {
+                writer.write(batch.data(), filled * sizeof(Key));
+                merged += filled;
+                filled = 0;
+                progress.keysWritten = merged;
+                if (progress.cancelled) return fail("cancelled");
+            }
         }
-        for (size_t i = 0; i < arr.size() && isSorting && !isPaused; ++i) {
-            updateBar(i, output[i]);
-            setBarColor(i, sf::Color(85, 255, 85));
-            draw();
-            setBarColor(i, sf::Color(75, 156, 234));
-            swaps++;
+        writer.write(batch.data(), filled * sizeof(Key));
+        progress.keysWritten = merged + filled;
+        for (size_t r = 0; r < k; ++r) progress.runsMerged[r] = progress.runLengths[r];
+        return true;
+    }
+
+public:
+    ExternalSorter(const ExternalOptions& opts, ExternalProgress& p) : options(opts), progress(p) {
+        if (options.tempPath.empty()) options.tempPath = options.outputPath + ".runs";
+    }
+
+    // Maps the input and fixes the run layout. A run takes half the memory budget; the other
+    // half is left for the algorithm's scratch space.
+    bool open(std::string& error) {
+        if (!input.open(options.inputPath, error)) return false;
+        if (input.size() % sizeof(Key) != 0) {
+            error = options.inputPath + " is not a whole number of keys";
+            return false;
         }
-        updateStats();
+        keysPerRun = std::max<size_t>(options.memoryBytes / (2 * sizeof(Key)), 1 << 16);
+        progress.algorithm = options.algorithm->name;
+        progress.setRuns(input.size() / sizeof(Key), keysPerRun);
+        return true;
     }
 
-    void radixSort() {
-        isSorting = true;
-        currentAlgorithm = "Radix Sort";
-        activeAlgorithmIndex = 8;
-        updateDetails("Time: O(nk)\nSpace: O(n + k)\nSorts by processing digits.");
-        comparisons = 0;
-        swaps = 0;
-        int maxVal = *std::max_element(arr.begin(), arr.end());
-        if (maxVal == 0) {
-            isSorting = false;
-            isPaused = false;
-            resetColors();
-            draw();
-            return;
+    // Runs both phases. A single run is written straight to the output.
+    bool run() {
+        std::string error;
+        bool direct = progress.runLengths.size() <= 1;
+        BlockWriter runWriter;
+        if (!runWriter.open(direct ? options.outputPath : options.tempPath, writeBlockBytes, error)) return fail(error);
+        bool formed = formRuns(runWriter);
+        if (!runWriter.close(error) || !formed) {
+            std::remove((direct ? options.outputPath : options.tempPath).c_str());
+            return formed ? fail(error) : false;
         }
-        for (int exp = 1; maxVal / exp > 0 && isSorting && !isPaused; exp *= 10) {
-            countingSortForRadix(exp);
+        input.close();
+        if (direct) {
+            progress.keysWritten = progress.totalKeys;
+            progress.phase = ExternalProgress::Done;
+            return true;
         }
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
+
+        progress.phase = ExternalProgress::Merging;
+        MappedFile runs;
+        BlockWriter output;
+        if (!runs.open(options.tempPath, error) || !output.open(options.outputPath, writeBlockBytes, error)) return fail(error);
+        bool merged = mergeRuns(runs, output);
+        bool closed = output.close(error);
+        runs.close();
+        std::remove(options.tempPath.c_str());
+        if (!merged) return false;
+        if (!closed) return fail(error);
+        progress.phase = ExternalProgress::Done;
+        return true;
     }
+};
 
-    void bucketSort() {
-        isSorting = true;
-        currentAlgorithm = "Bucket Sort";
-        activeAlgorithmIndex = 9;
-        updateDetails("Time: O(n + k)\nSpace: O(n + k)\nDistributes into buckets and sorts.");
-        comparisons = 0;
-        swaps = 0;
-        int maxVal = *std::max_element(arr.begin(), arr.end());
-        if (maxVal == 0) {
-            isSorting = false;
-            isPaused = false;
-            resetColors();
-            draw();
-            return;
-        }
-        int bucketCount = arr.size() / 10 + 1;
-        std::vector<std::vector<int>> buckets(bucketCount);
-        for (size_t i = 0; i < arr.size() && isSorting && !isPaused; ++i) {
-            int bucketIdx = arr[i] * bucketCount / (maxVal + 1);
-            buckets[bucketIdx].push_back(arr[i]);
-            setBarColor(i, sf::Color(255, 85, 85));
-            draw();
-            setBarColor(i, sf::Color(75, 156, 234));
-        }
-        size_t k = 0;
-        for (auto& bucket : buckets) {
-            std::sort(bucket.begin(), bucket.end());
-            for (int val : bucket) {
-                if (!isSorting || isPaused) break;
-                updateBar(k, val);
-                setBarColor(k, sf::Color(85, 255, 85));
-                draw();
-                setBarColor(k, sf::Color(75, 156, 234));
-                ++k;
-                swaps++;
+// Sorts options.inputPath into options.outputPath on a background thread, reporting progress
+// on stderr or, with `watch`, showing the runs in a window.
+template <typename Key>
+int runExternalSort(const ExternalOptions& options, bool watch) {
+    ExternalProgress progress;
+    ExternalSorter<Key> sorter(options, progress);
+    std::string error;
+    if (!sorter.open(error)) {
+        std::cerr << "External sort failed: " << error << "\n";
+        return 1;
+    }
+    std::cerr << "Sorting " << progress.totalKeys << " keys in " << progress.runLengths.size() << " runs with " << options.algorithm->id << "\n";
+    auto start = std::chrono::steady_clock::now();
+    std::thread worker([&] { sorter.run(); });
+    if (watch) {
+        sf::RenderWindow window(sf::VideoMode(800, 600), "Sorting Visualizer - external sort");
+        window.setFramerateLimit(60);
+        SortingVisualizer visualizer(window, 1);
+        visualizer.watchExternal(progress);
+        while (window.isOpen()) {
+            sf::Event event;
+            while (window.pollEvent(event)) {
+                if (event.type == sf::Event::Closed) window.close();
             }
+            visualizer.draw();
         }
-        updateStats();
-        isSorting = false;
-        isPaused = false;
-        resetColors();
-        draw();
+        progress.cancelled = true;
+    }
+    worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (progress.phase != ExternalProgress::Done) {
+        std::cerr << "External sort failed: " << progress.error << "\n";
+        return 1;
+    }
+    std::cerr << "Sorted " << progress.totalKeys << " keys in " << std::fixed << std::setprecision(2) << seconds << " s ("
+              << progress.totalKeys * sizeof(Key) / std::max(seconds, 1e-9) / 1e6 << " MB/s)\n";
+    return 0;
+}
+
+// Parses a byte count with an optional K, M or G suffix, e.g. "512M".
+size_t parseBytes(const std::string& text) {
+    size_t end = 0;
+    double value = std::stod(text, &end);
+    std::string suffix = text.substr(end);
+    if (suffix == "K" || suffix == "k") value *= 1 << 10;
+    else if (suffix == "M" || suffix == "m") value *= 1 << 20;
+    else if (suffix == "G" || suffix == "g") value *= 1 << 30;
+    else if (!suffix.empty()) throw std::invalid_argument(text);
+    return static_cast<size_t>(value);
+}
+
+// Splits "a,b,c" into its parts.
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> parts;
+    std::stringstream ss(list);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        if (!part.empty()) parts.push_back(part);
     }
+    return parts;
+}
 
-    void handleKeyPress(sf::Keyboard::Key key) {
-        if (key == sf::Keyboard::P) {
-            if (isSorting) {
-                isPaused = !isPaused;
-                updateDetails(algorithmDetails);
-                draw();
+// Parses cache levels as name=size/ways, smallest first, e.g. "L1=48K/12,L2=2M/16,LLC=36M/12";
+// "default" gives CacheSimulator::defaultLevels().
+std::vector<CacheSimulator::LevelConfig> parseCacheLevels(const std::string& text) {
+    if (text == "default") return CacheSimulator::defaultLevels();
+    std::vector<CacheSimulator::LevelConfig> levels;
+    for (const auto& part : splitList(text)) {
+        size_t equals = part.find('='), slash = part.find('/');
+        if (equals == std::string::npos || equals == 0 || slash == std::string::npos || slash < equals) throw std::invalid_argument(part);
+        levels.push_back({part.substr(0, equals), parseBytes(part.substr(equals + 1, slash - equals - 1)), static_cast<unsigned>(std::stoul(part.substr(slash + 1)))});
+    }
+    if (levels.empty()) throw std::invalid_argument(text);
+    return levels;
+}
+
+void printUsage() {
+    std::cerr << "Usage: visualizer [--size N] [--replay FILE]\n"
+                 "       visualizer [--size N] [--seed S] [--dist NAME] [--race quick,merge,...] [--cache LEVELS] [--k K]\n"
+                 "       visualizer --record FILE --algo NAME [--size N] [--seed S] [--max-value V] [--keyframe-interval N]\n"
+                 "                          [--dist NAME] [--swaps K]\n"
+                 "       visualizer --export FILE.y4m|DIR --algo NAME [--size N] [--seed S] [--dist NAME] [--ops-per-frame K]\n"
+                 "                          [--fps N] [--encoders N] [--cache LEVELS]\n"
+                 "       visualizer --bench [--sizes 1e3,1e5,...] [--algos quick,merge,...] [--reps N]\n"
+                 "                          [--seed S] [--max-value V] [--max-quadratic N] [--threads 1,2,4,...]\n"
+                 "                          [--format csv|json] [--output FILE] [--isa scalar|sse4|avx2]\n"
+                 "                          [--radix-bits 8|11] [--heap-arity 2|4|8] [--k K] [--key int32|uint64|float|double]\n"
+                 "                          [--records | --indirect] [--dist uniform,zipf,...] [--swaps K]\n"
+                 "                          [--cache default|L1=32K/8,L2=1M/16,...] [--cache-line 64]\n"
+                 "       Any mode: [--auto-table FILE] calibrates the auto algorithm from --bench CSV output\n"
+                 "       visualizer --external FILE --output FILE [--key int32|uint64|float|double] [--memory 512M]\n"
+                 "                          [--algo NAME] [--temp FILE] [--radix-bits 8|11] [--heap-arity 2|4|8] [--watch]\n"
+                 "Algorithms:";
+    for (const auto& info : algorithms) {
+        std::cerr << " " << info.id;
+    }
+    std::cerr << "\nDistributions:";
+    for (const auto& info : distributions) {
+        std::cerr << " " << info.id;
+    }
+    std::cerr << "\n";
+}
+
+int main(int argc, char** argv) {
+    processCounters().open(); // Before any thread starts, so the pools inherit the counters
+    int size = 100;
+    bool bench = false;
+    BenchConfig config;
+    std::string recordPath;
+    std::string replayPath;
+    uint64_t keyframeInterval = 0;
+    ExportOptions exportOptions;
+    ExternalOptions external;
+    bool watchExternal = false;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--bench") {
+                bench = true;
+            } else if (arg == "--size" && hasValue) {
+                size = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--sizes" && hasValue) {
+                config.sizes.clear();
+                for (const auto& part : splitList(argv[++i])) {
+                    config.sizes.push_back(static_cast<size_t>(std::stod(part))); // Accepts 1e6 notation
+                }
+            } else if (arg == "--record" && hasValue) {
+                recordPath = argv[++i];
+            } else if (arg == "--replay" && hasValue) {
+                replayPath = argv[++i];
+            } else if (arg == "--export" && hasValue) {
+                exportOptions.path = argv[++i];
+            } else if (arg == "--ops-per-frame" && hasValue) {
+                exportOptions.opsPerFrame = std::max(1ULL, static_cast<unsigned long long>(std::stod(argv[++i])));
+            } else if (arg == "--fps" && hasValue) {
+                exportOptions.fps = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--encoders" && hasValue) {
+                exportOptions.encoders = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--keyframe-interval" && hasValue) {
+                keyframeInterval = static_cast<uint64_t>(std::stod(argv[++i]));
+            } else if ((arg == "--algos" || arg == "--algo") && hasValue) {
+                for (const auto& part : splitList(argv[++i])) {
+                    auto it = std::find_if(algorithms.begin(), algorithms.end(), [&](const AlgorithmInfo& info) { return part == info.id; });
+                    if (it == algorithms.end()) {
+                        std::cerr << "Unknown algorithm: " << part << "\n";
+                        printUsage();
+                        return 1;
+                    }
+                    config.algorithmIndices.push_back(it - algorithms.begin());
+                }
+            } else if (arg == "--race" && hasValue) {
+                for (const auto& part : splitList(argv[++i])) {
+                    auto it = std::find_if(algorithms.begin(), algorithms.end(), [&](const AlgorithmInfo& info) { return part == info.id; });
+                    if (it == algorithms.end()) {
+                        std::cerr << "Unknown algorithm: " << part << "\n";
+                        printUsage();
+                        return 1;
+                    }
+                    config.raceIndices.push_back(it - algorithms.begin());
+                }
+            } else if (arg == "--dist" && hasValue) {
+                for (const auto& part : splitList(argv[++i])) {
+                    auto it = std::find_if(distributions.begin(), distributions.end(), [&](const DistributionInfo& info) { return part == info.id; });
+                    if (it == distributions.end()) {
+                        std::cerr << "Unknown distribution: " << part << "\n";
+                        printUsage();
+                        return 1;
+                    }
+                    config.distributionIndices.push_back(it - distributions.begin());
+                }
+            } else if (arg == "--external" && hasValue) {
+                external.inputPath = argv[++i];
+            } else if (arg == "--memory" && hasValue) {
+                external.memoryBytes = std::max<size_t>(parseBytes(argv[++i]), 1 << 20);
+            } else if (arg == "--temp" && hasValue) {
+                external.tempPath = argv[++i];
+            } else if (arg == "--watch") {
+                watchExternal = true;
+            } else if (arg == "--swaps" && hasValue) {
+                config.swaps = static_cast<size_t>(std::stod(argv[++i]));
+            } else if (arg == "--threads" && hasValue) {
+                config.threadCounts.clear();
+                for (const auto& part : splitList(argv[++i])) {
+                    config.threadCounts.push_back(std::max<size_t>(1, std::stoul(part)));
+                }
+            } else if (arg == "--reps" && hasValue) {
+                config.repetitions = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--seed" && hasValue) {
+                config.seed = static_cast<unsigned>(std::stoul(argv[++i]));
+            } else if (arg == "--max-value" && hasValue) {
+                config.maxValue = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--max-quadratic" && hasValue) {
+                config.quadraticLimit = static_cast<size_t>(std::stod(argv[++i]));
+            } else if (arg == "--format" && hasValue) {
+                config.json = std::string(argv[++i]) == "json";
+            } else if (arg == "--output" && hasValue) {
+                config.outputPath = argv[++i];
+            } else if (arg == "--radix-bits" && hasValue) {
+                config.radixBits = std::stoi(argv[++i]) == 11 ? 11 : 8;
+            } else if (arg == "--k" && hasValue) {
+                config.selectCount = static_cast<size_t>(std::stod(argv[++i]));
+            } else if (arg == "--heap-arity" && hasValue) {
+                config.heapArity = std::stoi(argv[++i]);
+                if (config.heapArity != 2 && config.heapArity != 4 && config.heapArity != 8) throw std::invalid_argument("heap arity");
+            } else if (arg == "--key" && hasValue) {
+                config.keyType = argv[++i];
+                if (config.keyType != "int32" && config.keyType != "uint64" && config.keyType != "float" && config.keyType != "double") {
+                    throw std::invalid_argument(config.keyType);
+                }
+            } else if (arg == "--cache" && hasValue) {
+                config.cacheLevels = parseCacheLevels(argv[++i]);
+            } else if (arg == "--cache-line" && hasValue) {
+                config.cacheLine = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--auto-table" && hasValue) {
+                std::string error;
+                if (!loadCalibration(argv[++i], error)) {
+                    std::cerr << "Cannot calibrate auto: " << error << "\n";
+                    return 1;
+                }
+            } else if (arg == "--records") {
+                config.layout = "records";
+            } else if (arg == "--indirect") {
+                config.layout = "indirect";
+            } else if (arg == "--isa" && hasValue) {
+                std::string isa = argv[++i];
+                if (isa != "scalar" && isa != "sse4" && isa != "avx2") throw std::invalid_argument(isa);
+                SortingNetwork::setIsa(isa == "avx2" ? SortingNetwork::Isa::Avx2 : isa == "sse4" ? SortingNetwork::Isa::Sse41 : SortingNetwork::Isa::Scalar);
+            } else {
+                printUsage();
+                return 1;
             }
-            return;
         }
-        if (key == sf::Keyboard::Add && delayMs > 1) {
-            delayMs -= 1;
-            updateStats();
-            draw();
-            return;
+    } catch (const std::exception&) {
+        printUsage();
+        return 1;
+    }
+
+    if (config.distributionIndices.empty()) {
+        config.distributionIndices.push_back(0);
+    }
+
+    if (!external.inputPath.empty()) {
+        if (config.outputPath.empty() || config.algorithmIndices.size() > 1) {
+            std::cerr << "--external needs --output and at most one --algo\n";
+            return 1;
         }
-        if (key == sf::Keyboard::Subtract && delayMs < 50) {
-            delayMs += 1;
-            updateStats();
-            draw();
-            return;
+        external.outputPath = config.outputPath;
+        external.radixBits = config.radixBits;
+        external.heapArity = config.heapArity;
+        if (config.algorithmIndices.empty()) {
+            auto radix = std::find_if(algorithms.begin(), algorithms.end(), [](const AlgorithmInfo& info) { return std::string(info.id) == "radix"; });
+            config.algorithmIndices.push_back(radix - algorithms.begin());
         }
-        if (isSorting) {
-            isSorting = false;
-            isPaused = false;
-            activeAlgorithmIndex = -1;
-            resetColors();
-            updateDetails("Sorting stopped. Select an algorithm.");
-            draw();
-            return;
+        external.algorithm = &algorithms[config.algorithmIndices[0]];
+        if (external.algorithm->output != SortOutput::Sorted) {
+            std::cerr << "--external needs a full sort, not " << external.algorithm->id << "\n";
+            return 1;
         }
-        switch (key) {
-            case sf::Keyboard::Num1: bubbleSort(); break;
-            case sf::Keyboard::Num2: selectionSort(); break;
-            case sf::Keyboard::Num3: insertionSort(); break;
-            case sf::Keyboard::Num4: startQuickSort(); break;
-            case sf::Keyboard::Num5: startMergeSort(); break;
-            case sf::Keyboard::Num6: startHeapSort(); break;
-            case sf::Keyboard::Num7: timSort(); break;
-            case sf::Keyboard::Num8: countingSort(); break;
-            case sf::Keyboard::Num9: radixSort(); break;
-            case sf::Keyboard::Num0: bucketSort(); break;
-            case sf::Keyboard::R: resetArray(); break;
-            default: break;
+        if (config.keyType == "uint64") return runExternalSort<uint64_t>(external, watchExternal);
+        if (config.keyType == "float") return runExternalSort<float>(external, watchExternal);
+        if (config.keyType == "double") return runExternalSort<double>(external, watchExternal);
+        return runExternalSort<int32_t>(external, watchExternal);
+    }
+
+    if (!recordPath.empty()) {
+        if (config.algorithmIndices.size() != 1) {
+            std::cerr << "--record needs exactly one --algo\n";
+            return 1;
         }
+        return recordTrace(recordPath, algorithms[config.algorithmIndices[0]], size, config, keyframeInterval) ? 0 : 1;
     }
 
-    bool isSortingNow() const { return isSorting; }
-    bool isPausedNow() const { return isPaused; }
-};
+    if (!exportOptions.path.empty()) {
+        if (config.algorithmIndices.size() != 1) {
+            std::cerr << "--export needs exactly one --algo\n";
+            return 1;
+        }
+        return exportFrames(exportOptions, algorithms[config.algorithmIndices[0]], size, config) ? 0 : 1;
+    }
+
+    if (bench) {
+        if (config.algorithmIndices.empty()) {
+            for (size_t i = 0; i < algorithms.size(); ++i) {
+                config.algorithmIndices.push_back(i);
+            }
+        }
+        std::cerr << "Sorting network kernels: " << SortingNetwork::isaName() << "\n";
+        std::cerr << "Hardware counters: " << processCounters().status() << "\n";
+        std::vector<BenchResult> results = runBenchmark(config);
+        if (config.outputPath.empty()) {
+            writeBenchResults(std::cout, results, config);
+        } else {
+            std::ofstream out(config.outputPath);
+            if (!out) {
+                std::cerr << "Cannot open " << config.outputPath << "\n";
+                return 1;
+            }
+            writeBenchResults(out, results, config);
+        }
+        return 0;
+    }
 
-int main() {
     sf::RenderWindow window(sf::VideoMode(800, 600), "Sorting Visualizer");
     window.setFramerateLimit(60);
-    SortingVisualizer visualizer(window, 100, 5);
+    SortingVisualizer visualizer(window, size, 256, config.seed);
+    visualizer.selectDistribution(config.distributionIndices[0]);
+    visualizer.setRaceAlgorithms(config.raceIndices);
+    visualizer.setCacheLevels(config.cacheLevels, config.cacheLine);
+    if (config.selectCount) visualizer.setSelectCount(config.selectCount);
+    if (!config.cacheLevels.empty()) visualizer.enableCacheSimulator(true);
+    if (!replayPath.empty()) {
+        std::string error;
+        if (!visualizer.openReplay(replayPath, error)) {
+            std::cerr << "Cannot replay " << replayPath << ": " << error << "\n";
+            return 1;
+        }
+    } else if (!config.raceIndices.empty()) {
+        visualizer.startRace();
+    }
 
     while (window.isOpen()) {
         sf::Event event;
@@ -736,9 +6278,8 @@ int main() {
                 visualizer.handleMouseClick(sf::Mouse::getPosition(window));
             }
         }
-        if (!visualizer.isSortingNow() || (visualizer.isSortingNow() && !visualizer.isPausedNow())) {
-            visualizer.draw();
-        }
+        visualizer.advance();
+        visualizer.draw();
     }
     return 0;
-}
\ No newline at end of file
+}